@@ -6,7 +6,9 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <stdexcept>
 #include "bst.h"
+#include "thread_pool.h"
 
 struct KeyError { };
 
@@ -20,20 +22,22 @@ class AVLNode : public Node<Key, Value>
 {
 public:
     // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    template<typename K, typename V>
+    AVLNode(K&& key, V&& value, AVLNode<Key, Value>* parent);
+    AVLNode(ItemBuilder<Key, Value>& builder, AVLNode<Key, Value>* parent);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since they
+    // Getters for parent, left, and right. These hide the Node versions since they
     // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
     // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
     int8_t balance_;    // effectively a signed char
@@ -46,11 +50,19 @@ protected:
 */
 
 /**
-* An explicit constructor to initialize the elements by calling the base class constructor
+* An explicit constructor to initialize the elements by forwarding to the base class constructor
 */
 template<class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+template<typename K, typename V>
+AVLNode<Key, Value>::AVLNode(K&& key, V&& value, AVLNode<Key, Value> *parent) :
+    Node<Key, Value>(std::forward<K>(key), std::forward<V>(value), parent), balance_(0)
+{
+
+}
+
+template<class Key, class Value>
+AVLNode<Key, Value>::AVLNode(ItemBuilder<Key, Value>& builder, AVLNode<Key, Value> *parent) :
+    Node<Key, Value>(builder, parent), balance_(0)
 {
 
 }
@@ -92,8 +104,8 @@ void AVLNode<Key, Value>::updateBalance(int8_t diff)
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* A getter for the parent that hides the Node version, since a static_cast is necessary to
+* make sure that our node is a AVLNode.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
@@ -127,162 +139,990 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+template <class Key, class Value, class Compare = std::less<Key> >
+class AVLTree : public BinarySearchTree<Key, Value, Compare>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item) override; // TODO
+    AVLTree();
+    explicit AVLTree(const Compare& comp);
+    template<typename ForwardIt>
+    AVLTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+    virtual ~AVLTree();
     virtual void remove(const Key& key) override;  // TODO
+
+    // Cutting and gluing whole trees in O(log n); nodes move between the
+    // trees without being copied. split() leaves the keys below key here
+    // and moves the rest into right. join() appends pivot and then all of
+    // right, whose keys must all be greater, leaving right empty.
+    void split(const Key& key, AVLTree& right);
+    void join(const std::pair<const Key, Value>& pivot, AVLTree& right);
+    void join(AVLTree& right);
+
+    // Set operations in O(m log(n/m + 1)) for trees of sizes m <= n, built
+    // on split and join. other's nodes are moved in or destroyed and other
+    // is left empty. With a pool, big enough halves run in parallel.
+    void union_with(AVLTree& other, ThreadPool* pool = nullptr);
+    void intersect_with(AVLTree& other, ThreadPool* pool = nullptr);
+    void difference_with(AVLTree& other, ThreadPool* pool = nullptr);
+
+    // Applying a whole batch in one merge descent instead of a descent per
+    // key. A key repeated in the batch ends up with its last value, just
+    // as with a loop of insert() calls.
+    template<typename ForwardIt>
+    void insert_batch(ForwardIt first, ForwardIt last, ThreadPool* pool = nullptr);
+    template<typename ForwardIt>
+    void erase_batch(ForwardIt first, ForwardIt last, ThreadPool* pool = nullptr);
 protected:
+    enum SetOperation { Union, Intersection, Difference };
+
+    // Subtrees shorter than this on either side are combined serially,
+    // as are batches smaller than parallelCutoffBatch.
+    static const int parallelCutoffHeight = 12;
+    static const std::size_t parallelCutoffBatch = 1024;
+
     //virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2) override;
     virtual void nodeSwap(Node<Key,Value>* n1, Node<Key,Value>* n2) override;
+    virtual void destroyNode(Node<Key,Value>* node) override;
+    virtual Node<Key, Value>* makeNode(Node<Key, Value>* parent, ItemBuilder<Key, Value>& builder) override;
+    virtual void rebalanceAfterInsert(Node<Key, Value>* node) override;
+    virtual void noteHeights(Node<Key, Value>* node, int leftHeight, int rightHeight) override;
 
     // Add helper functions here
     AVLNode<Key, Value>* balance(AVLNode<Key, Value>* node);
     AVLNode<Key, Value>* rotateLeft(AVLNode<Key, Value>* node);
     AVLNode<Key, Value>* rotateRight(AVLNode<Key, Value>* node);
-    int getBalanceFactor(AVLNode<Key, Value>* node);
-    int getHeight(AVLNode<Key, Value>* node);
-    AVLNode<Key, Value>* insertRecursive(AVLNode<Key, Value>* node, const std::pair<const Key, Value>& new_item);
-    AVLNode<Key, Value>* removeRecursive(AVLNode<Key, Value>* node, const Key& key);
+    void insertFix(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* child);
+    void removeFix(AVLNode<Key, Value>* node, int8_t diff);
+    void unlinkNode(AVLNode<Key, Value>* node);
+    static int heightOf(AVLNode<Key, Value>* node);
+    AVLNode<Key, Value>* joinNodes(AVLNode<Key, Value>* left, AVLNode<Key, Value>* pivot, AVLNode<Key, Value>* right,
+                                   int leftHeight, int rightHeight, int& height);
+    void splitNodes(AVLNode<Key, Value>* node, int height, const Key& key,
+                    AVLNode<Key, Value>*& left, int& leftHeight, AVLNode<Key, Value>*& right, int& rightHeight,
+                    AVLNode<Key, Value>*& match);
+    AVLNode<Key, Value>* splitLast(AVLNode<Key, Value>* node, int height, AVLNode<Key, Value>*& last, int& restHeight);
+    AVLNode<Key, Value>* joinNodes(AVLNode<Key, Value>* left, AVLNode<Key, Value>* right,
+                                   int leftHeight, int rightHeight, int& height);
+    void joinWith(AVLNode<Key, Value>* pivot, AVLTree& right);
+    void combineWith(SetOperation op, AVLTree& other, ThreadPool* pool);
+    AVLNode<Key, Value>* combineNodes(SetOperation op, AVLNode<Key, Value>* a, int aHeight,
+                                      AVLNode<Key, Value>* b, int bHeight, int& height,
+                                      std::vector<AVLNode<Key, Value>*>& discarded, ThreadPool* pool);
+    AVLNode<Key, Value>* linkBatch(const std::vector<AVLNode<Key, Value>*>& nodes, std::size_t lo, std::size_t hi,
+                                   int& height);
+    AVLNode<Key, Value>* insertNodes(AVLNode<Key, Value>* node, int nodeHeight,
+                                     const std::vector<AVLNode<Key, Value>*>& nodes, std::size_t lo, std::size_t hi,
+                                     int& height, std::vector<AVLNode<Key, Value>*>& duplicates, ThreadPool* pool);
+    AVLNode<Key, Value>* eraseKeys(AVLNode<Key, Value>* node, int nodeHeight, const std::vector<Key>& keys,
+                                   std::size_t lo, std::size_t hi, int& height,
+                                   std::vector<AVLNode<Key, Value>*>& erased, ThreadPool* pool);
     AVLNode<Key, Value>* findPredecessorAVL(AVLNode<Key, Value>* node);
 };
 
+/**
+* Sizes the node pool for AVLNodes.
+*/
+template<class Key, class Value, class Compare>
+AVLTree<Key, Value, Compare>::AVLTree() :
+    BinarySearchTree<Key, Value, Compare>(sizeof(AVLNode<Key, Value>), Compare())
+{
+
+}
+
+/**
+* Orders keys with the given comparison object.
+*/
+template<class Key, class Value, class Compare>
+AVLTree<Key, Value, Compare>::AVLTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(AVLNode<Key, Value>), comp)
+{
+
+}
+
+/**
+* Builds a balanced tree from the pairs in [first, last). See assign().
+*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+AVLTree<Key, Value, Compare>::AVLTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(AVLNode<Key, Value>), comp)
+{
+    this->assign(first, last);
+}
+
+/**
+* Clears here rather than in the base destructor so that our
+* destroyNode() is the one that runs.
+*/
+template<class Key, class Value, class Compare>
+AVLTree<Key, Value, Compare>::~AVLTree()
+{
+    this->clear();
+}
+
 /*
  * Recall: If key is already in the tree, you should 
  * overwrite the current value with the updated value.
+ * Inserting is done by BinarySearchTree::insert(); these hooks make it
+ * build AVLNodes and retrace balances once the new node is linked in.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+template<class Key, class Value, class Compare>
+Node<Key, Value>* AVLTree<Key, Value, Compare>::makeNode(Node<Key, Value>* parent, ItemBuilder<Key, Value>& builder)
 {
-    // TODO
-    this->root_ = insertRecursive(static_cast<AVLNode<Key, Value>*>(this->root_), new_item);
-    if (this->root_) {
-      this->root_->setParent(nullptr);
-    }
+    return this->createNode(builder, static_cast<AVLNode<Key, Value>*>(parent));
 }
 
-template <class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::insertRecursive(AVLNode<Key, Value>* node, const std::pair<const Key, Value>& new_item) {
-  if (node == nullptr) {
-    return new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
-  }
-
-  if (new_item.first < node->getKey()) {
-    AVLNode<Key, Value>* leftChild = insertRecursive(node->getLeft(), new_item);
-    node->setLeft(leftChild);
-    leftChild->setParent(node);
-  } 
-  else if (new_item.first > node->getKey()) {
-    AVLNode<Key, Value>* rightChild = insertRecursive(node->getRight(), new_item);
-    node->setRight(rightChild);
-    rightChild->setParent(node);
-  } 
-  else {
-    node->setValue(new_item.second);
-    return node;
-  }
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::rebalanceAfterInsert(Node<Key, Value>* node)
+{
+    AVLNode<Key, Value>* avlNode = static_cast<AVLNode<Key, Value>*>(node);
+    insertFix(avlNode->getParent(), avlNode);
+}
 
-  return balance(node);
+/**
+ * Walks up from a freshly attached node, updating balances until some
+ * subtree's height stops changing. At most one (single or double) rotation
+ * is done, since a rotation after an insert restores the old height.
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::insertFix(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* child) {
+  while (parent != nullptr) {
+    parent->updateBalance(child == parent->getLeft() ? -1 : 1);
+    if (parent->getBalance() == 0) {
+      // the shorter side caught up, so the height did not change
+      return;
+    }
+    if (parent->getBalance() == -2 || parent->getBalance() == 2) {
+      balance(parent);
+      return;
+    }
+    child = parent;
+    parent = parent->getParent();
+  }
 }
 
 /*
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>:: remove(const Key& key)
 {
     // TODO
-    this->root_ = removeRecursive(static_cast<AVLNode<Key, Value>*>(this->root_), key);
-  if (this->root_) {
-    this->root_->setParent(nullptr);
+    AVLNode<Key, Value>* node = static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
+    if (node == nullptr) {
+      return;
+    }
+    unlinkNode(node);
+    this->destroyNode(node);
+}
+
+/**
+ * Takes node out of the tree and rebalances, without destroying it.
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::unlinkNode(AVLNode<Key, Value>* node)
+{
+    if (node == this->rightmost_) {
+      this->rightmost_ = this->predecessor(node);
+    }
+    if (node->getLeft() != nullptr && node->getRight() != nullptr) {
+      // the predecessor takes over node's position and balance
+      nodeSwap(node, findPredecessorAVL(node));
+    }
+
+    AVLNode<Key, Value>* child = node->getLeft() ? node->getLeft() : node->getRight();
+    AVLNode<Key, Value>* parent = node->getParent();
+    int8_t diff = 0;
+    if (child != nullptr) {
+      child->setParent(parent);
+    }
+    if (parent == nullptr) {
+      this->root_ = child;
+    }
+    else if (parent->getLeft() == node) {
+      parent->setLeft(child);
+      diff = 1;
+    }
+    else {
+      parent->setRight(child);
+      diff = -1;
+    }
+    --this->size_;
+    this->addToCounts(parent, -1);
+    this->unthreadNode(node);
+
+    removeFix(parent, diff);
+}
+
+/**
+ * Splits this tree at key in O(log n): keys less than key stay, the rest
+ * move into right, replacing whatever right held. right shares our node
+ * storage from then on. BST_ORDER_STATISTICS reads both sizes off the
+ * halves' roots; otherwise they are left stale, and the next size() on
+ * either half counts it.
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::split(const Key& key, AVLTree& right)
+{
+    if (&right == this) {
+      throw std::invalid_argument("AVLTree::split needs a separate tree");
+    }
+    right.clear();
+    right.pool_.share(this->pool_);
+
+    AVLNode<Key, Value>* lower;
+    AVLNode<Key, Value>* upper;
+    AVLNode<Key, Value>* match;
+    int lowerHeight;
+    int upperHeight;
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    splitNodes(root, heightOf(root), key, lower, lowerHeight, upper, upperHeight, match);
+    if (match != nullptr) {
+      // key itself belongs with the upper half, as its smallest entry
+      upper = joinNodes(nullptr, match, upper, 0, upperHeight, upperHeight);
+    }
+    this->root_ = lower;
+    right.root_ = upper;
+    if (upper == nullptr) {
+      return;
+    }
+
+    right.rightmost_ = this->rightmost_;
+    this->rightmost_ = lower;
+    while (this->rightmost_ != nullptr && this->rightmost_->getRight() != nullptr) {
+      this->rightmost_ = this->rightmost_->getRight();
+    }
+    this->chainNodes(this->rightmost_, nullptr);
+    this->chainNodes(nullptr, right.getSmallestNode());
+
+#ifdef BST_ORDER_STATISTICS
+    this->size_ = lower ? lower->getCount() : 0;
+    right.size_ = upper->getCount();
+#else
+    this->sizeStale_ = true;
+    right.sizeStale_ = true;
+#endif
+}
+
+/**
+ * Joins this tree, a new pivot entry and right into this tree in
+ * O(log n). Throws std::invalid_argument unless every key here is less
+ * than the pivot's and the pivot's is less than every key in right.
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::join(const std::pair<const Key, Value>& pivot, AVLTree& right)
+{
+    if (&right == this) {
+      throw std::invalid_argument("AVLTree::join needs a separate tree");
+    }
+    if ((this->rightmost_ != nullptr && !this->comp_(this->rightmost_->getKey(), pivot.first)) ||
+        (right.root_ != nullptr && !this->comp_(pivot.first, right.getSmallestNode()->getKey()))) {
+      throw std::invalid_argument("AVLTree::join keys out of order");
+    }
+    joinWith(this->template createNode<AVLNode<Key, Value> >(pivot.first, pivot.second, nullptr), right);
+}
+
+/**
+ * Appends right to this tree in O(log n), using our largest node as the
+ * pivot. Throws std::invalid_argument unless right's keys are all greater.
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::join(AVLTree& right)
+{
+    if (&right == this) {
+      throw std::invalid_argument("AVLTree::join needs a separate tree");
+    }
+    if (right.root_ == nullptr) {
+      return;
+    }
+    if (this->root_ == nullptr) {
+      // right's smallest node becomes the pivot instead
+      AVLNode<Key, Value>* pivot = static_cast<AVLNode<Key, Value>*>(right.getSmallestNode());
+      right.unlinkNode(pivot);
+      joinWith(pivot, right);
+      return;
+    }
+    if (!this->comp_(this->rightmost_->getKey(), right.getSmallestNode()->getKey())) {
+      throw std::invalid_argument("AVLTree::join keys out of order");
+    }
+    AVLNode<Key, Value>* pivot = static_cast<AVLNode<Key, Value>*>(this->rightmost_);
+    unlinkNode(pivot);
+    joinWith(pivot, right);
+}
+
+/**
+ * Does the work of join() once the order is known to be right: hangs our
+ * tree, the detached pivot node and right's tree together, takes over
+ * right's nodes and storage, and leaves right empty.
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::joinWith(AVLNode<Key, Value>* pivot, AVLTree& right)
+{
+    this->pool_.share(right.pool_);
+    AVLNode<Key, Value>* lower = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* upper = static_cast<AVLNode<Key, Value>*>(right.root_);
+    this->chainNodes(this->rightmost_, pivot);
+    this->chainNodes(pivot, right.getSmallestNode());
+
+    int height;
+    this->root_ = joinNodes(lower, pivot, upper, heightOf(lower), heightOf(upper), height);
+    this->rightmost_ = upper ? right.rightmost_ : pivot;
+    this->size_ += right.size_ + 1;
+    this->sizeStale_ = this->sizeStale_ || right.sizeStale_;
+
+    right.root_ = nullptr;
+    right.rightmost_ = nullptr;
+    right.size_ = 0;
+    right.sizeStale_ = false;
+    right.pool_.release();
+}
+
+/**
+ * Height of a subtree in O(log n), found by always stepping to the taller
+ * child as told by the stored balances.
+ */
+template<class Key, class Value, class Compare>
+int AVLTree<Key, Value, Compare>::heightOf(AVLNode<Key, Value>* node)
+{
+    int height = 0;
+    while (node != nullptr) {
+      height++;
+      node = node->getBalance() > 0 ? node->getRight() : node->getLeft();
+    }
+    return height;
+}
+
+/**
+ * Joins two detached subtrees of known height around pivot, where every
+ * key in left < pivot < every key in right, and returns the detached
+ * result along with its height. The shorter tree is hung, with the pivot
+ * above it, off the spine of the taller one where the heights match; the
+ * way back up then works just like retracing an insert, so it costs
+ * O(|leftHeight - rightHeight| + 1). Rotations only touch root_ when
+ * they move the node it points at; callers set it once they are done.
+ */
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::joinNodes(
+    AVLNode<Key, Value>* left, AVLNode<Key, Value>* pivot, AVLNode<Key, Value>* right,
+    int leftHeight, int rightHeight, int& height)
+{
+  if (leftHeight > rightHeight + 1) {
+    AVLNode<Key, Value>* inner = left->getRight();
+    int innerHeight = leftHeight - (left->getBalance() < 0 ? 2 : 1);
+    int outerHeight = leftHeight - (left->getBalance() > 0 ? 2 : 1);
+    if (inner != nullptr) {
+      inner->setParent(nullptr);
+    }
+    int joinedHeight;
+    AVLNode<Key, Value>* joined = joinNodes(inner, pivot, right, innerHeight, rightHeight, joinedHeight);
+    left->setRight(joined);
+    joined->setParent(left);
+    left->setBalance(static_cast<int8_t>(joinedHeight - outerHeight));
+    this->recount(left);
+    if (left->getBalance() < 2) {
+      height = 1 + std::max(outerHeight, joinedHeight);
+      return left;
+    }
+    height = joined->getBalance() == 0 ? joinedHeight + 1 : joinedHeight;
+    return balance(left);
+  }
+  if (rightHeight > leftHeight + 1) {
+    AVLNode<Key, Value>* inner = right->getLeft();
+    int innerHeight = rightHeight - (right->getBalance() > 0 ? 2 : 1);
+    int outerHeight = rightHeight - (right->getBalance() < 0 ? 2 : 1);
+    if (inner != nullptr) {
+      inner->setParent(nullptr);
+    }
+    int joinedHeight;
+    AVLNode<Key, Value>* joined = joinNodes(left, pivot, inner, leftHeight, innerHeight, joinedHeight);
+    right->setLeft(joined);
+    joined->setParent(right);
+    right->setBalance(static_cast<int8_t>(outerHeight - joinedHeight));
+    this->recount(right);
+    if (right->getBalance() > -2) {
+      height = 1 + std::max(outerHeight, joinedHeight);
+      return right;
+    }
+    height = joined->getBalance() == 0 ? joinedHeight + 1 : joinedHeight;
+    return balance(right);
   }
+
+  // close enough in height for the pivot to take both as children
+  pivot->setParent(nullptr);
+  pivot->setLeft(left);
+  pivot->setRight(right);
+  if (left != nullptr) {
+    left->setParent(pivot);
+  }
+  if (right != nullptr) {
+    right->setParent(pivot);
+  }
+  pivot->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+  this->recount(pivot);
+  height = 1 + std::max(leftHeight, rightHeight);
+  return pivot;
 }
 
-template <class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::removeRecursive(AVLNode<Key, Value>* node, const Key& key) {
+/**
+ * Splits a detached subtree of known height into the keys below key and
+ * the keys above it; a node holding key itself is handed back detached in
+ * match, which is NULL otherwise. Each level on the way down sets one
+ * child aside, and the way back up joins it onto the matching half with
+ * the node itself as pivot. The joins' costs telescope, so the whole
+ * split is O(height).
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::splitNodes(AVLNode<Key, Value>* node, int height, const Key& key,
+    AVLNode<Key, Value>*& left, int& leftHeight, AVLNode<Key, Value>*& right, int& rightHeight,
+    AVLNode<Key, Value>*& match)
+{
   if (node == nullptr) {
-    return nullptr;
+    left = right = match = nullptr;
+    leftHeight = rightHeight = 0;
+    return;
+  }
+  AVLNode<Key, Value>* lower = node->getLeft();
+  AVLNode<Key, Value>* upper = node->getRight();
+  int lowerHeight = height - (node->getBalance() > 0 ? 2 : 1);
+  int upperHeight = height - (node->getBalance() < 0 ? 2 : 1);
+  if (lower != nullptr) {
+    lower->setParent(nullptr);
+  }
+  if (upper != nullptr) {
+    upper->setParent(nullptr);
   }
+  if (this->comp_(node->getKey(), key)) {
+    AVLNode<Key, Value>* middle;
+    int middleHeight;
+    splitNodes(upper, upperHeight, key, middle, middleHeight, right, rightHeight, match);
+    left = joinNodes(lower, node, middle, lowerHeight, middleHeight, leftHeight);
+  }
+  else if (this->comp_(key, node->getKey())) {
+    AVLNode<Key, Value>* middle;
+    int middleHeight;
+    splitNodes(lower, lowerHeight, key, left, leftHeight, middle, middleHeight, match);
+    right = joinNodes(middle, node, upper, middleHeight, upperHeight, rightHeight);
+  }
+  else {
+    left = lower;
+    leftHeight = lowerHeight;
+    right = upper;
+    rightHeight = upperHeight;
+    node->setLeft(nullptr);
+    node->setRight(nullptr);
+    match = node;
+  }
+}
 
-  if (key < node->getKey()) {
-    node->setLeft(removeRecursive(node->getLeft(), key));
-    if (node->getLeft()) {
-      node->getLeft()->setParent(node);
+/**
+ * Takes the largest node out of a detached subtree of known height,
+ * returning what is left and its height. Costs O(height), since the
+ * joins on the way back up telescope as in splitNodes().
+ */
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::splitLast(AVLNode<Key, Value>* node, int height,
+    AVLNode<Key, Value>*& last, int& restHeight)
+{
+  AVLNode<Key, Value>* lower = node->getLeft();
+  AVLNode<Key, Value>* upper = node->getRight();
+  int lowerHeight = height - (node->getBalance() > 0 ? 2 : 1);
+  if (lower != nullptr) {
+    lower->setParent(nullptr);
+  }
+  if (upper == nullptr) {
+    node->setLeft(nullptr);
+    last = node;
+    restHeight = lowerHeight;
+    return lower;
+  }
+  upper->setParent(nullptr);
+  int upperHeight = height - (node->getBalance() < 0 ? 2 : 1);
+  int middleHeight;
+  AVLNode<Key, Value>* middle = splitLast(upper, upperHeight, last, middleHeight);
+  return joinNodes(lower, node, middle, lowerHeight, middleHeight, restHeight);
+}
+
+/**
+ * Joins two detached subtrees without a pivot of their own, borrowing
+ * the largest node of left for one.
+ */
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::joinNodes(AVLNode<Key, Value>* left, AVLNode<Key, Value>* right,
+    int leftHeight, int rightHeight, int& height)
+{
+  if (left == nullptr) {
+    height = rightHeight;
+    return right;
+  }
+  AVLNode<Key, Value>* pivot;
+  int restHeight;
+  AVLNode<Key, Value>* rest = splitLast(left, leftHeight, pivot, restHeight);
+  return joinNodes(rest, pivot, right, restHeight, rightHeight, height);
+}
+
+/**
+ * Adds other's entries to this tree; where both hold a key, other's
+ * value wins, just as if each of its entries had been inserted.
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::union_with(AVLTree& other, ThreadPool* pool)
+{
+    if (&other != this) {
+      combineWith(Union, other, pool);
+    }
+}
+
+/**
+ * Keeps only the entries whose keys other holds too, with our values.
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::intersect_with(AVLTree& other, ThreadPool* pool)
+{
+    if (&other != this) {
+      combineWith(Intersection, other, pool);
     }
-  } 
-  else if (key > node->getKey()) {
-    node->setRight(removeRecursive(node->getRight(), key));
-    if (node->getRight()) {
-      node->getRight()->setParent(node);
+}
+
+/**
+ * Drops every entry whose key other holds.
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::difference_with(AVLTree& other, ThreadPool* pool)
+{
+    if (&other == this) {
+      this->clear();
+      return;
+    }
+    combineWith(Difference, other, pool);
+}
+
+/**
+ * Runs a set operation over both whole trees, then frees the nodes that
+ * did not make it into the result. Nodes are only freed afterwards, on
+ * this thread, since the pool's free list is not thread safe. root_ is
+ * cleared for the duration so that concurrent rotations never write it.
+ * Every node either ends up in the result or is freed, so the result's
+ * size follows from the number freed. Under BST_THREADED, combineNodes()
+ * relinks the chain where it joins pieces, and only the two ends are left
+ * to cut here.
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::combineWith(SetOperation op, AVLTree& other, ThreadPool* pool)
+{
+    this->pool_.share(other.pool_);
+    AVLNode<Key, Value>* a = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* b = static_cast<AVLNode<Key, Value>*>(other.root_);
+    this->root_ = nullptr;
+    other.root_ = nullptr;
+    other.rightmost_ = nullptr;
+
+    std::vector<AVLNode<Key, Value>*> discarded;
+    int height;
+    AVLNode<Key, Value>* root = combineNodes(op, a, heightOf(a), b, heightOf(b), height, discarded, pool);
+    this->size_ += other.size_;
+    this->sizeStale_ = this->sizeStale_ || other.sizeStale_;
+    other.size_ = 0;
+    other.sizeStale_ = false;
+    for (std::size_t i = 0; i < discarded.size(); ++i) {
+      this->size_ -= this->destroySubtree(discarded[i]);
+    }
+    other.pool_.release();
+
+    this->root_ = root;
+    this->rightmost_ = root;
+    while (this->rightmost_ != nullptr && this->rightmost_->getRight() != nullptr) {
+      this->rightmost_ = this->rightmost_->getRight();
+    }
+    if (root != nullptr) {
+      this->chainNodes(nullptr, this->getSmallestNode());
+      this->chainNodes(this->rightmost_, nullptr);
+    }
+}
+
+/**
+ * Combines detached subtrees a (ours) and b (other's) of known heights
+ * and returns the result with its height; subtrees and nodes left out
+ * are added to discarded. b's root splits a, the two halves are combined
+ * recursively, and the results are joined back with b's root or a's
+ * matching node as pivot when the operation keeps it. The halves touch
+ * disjoint nodes, so they can run in parallel once both inputs are at
+ * least parallelCutoffHeight tall. Every piece comes out of a or b in
+ * order, so under BST_THREADED only the joins need their chain links
+ * redone.
+ */
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::combineNodes(SetOperation op,
+    AVLNode<Key, Value>* a, int aHeight, AVLNode<Key, Value>* b, int bHeight, int& height,
+    std::vector<AVLNode<Key, Value>*>& discarded, ThreadPool* pool)
+{
+  if (a == nullptr || b == nullptr) {
+    AVLNode<Key, Value>* kept = nullptr;
+    height = 0;
+    if (op == Union || (op == Difference && a != nullptr)) {
+      kept = a ? a : b;
+      height = a ? aHeight : bHeight;
+    }
+    if (a != nullptr && a != kept) {
+      discarded.push_back(a);
+    }
+    if (b != nullptr && b != kept) {
+      discarded.push_back(b);
+    }
+    return kept;
+  }
+
+  AVLNode<Key, Value>* bLower = b->getLeft();
+  AVLNode<Key, Value>* bUpper = b->getRight();
+  int bLowerHeight = bHeight - (b->getBalance() > 0 ? 2 : 1);
+  int bUpperHeight = bHeight - (b->getBalance() < 0 ? 2 : 1);
+  if (bLower != nullptr) {
+    bLower->setParent(nullptr);
+  }
+  if (bUpper != nullptr) {
+    bUpper->setParent(nullptr);
+  }
+  b->setLeft(nullptr);
+  b->setRight(nullptr);
+
+  AVLNode<Key, Value>* aLower;
+  AVLNode<Key, Value>* aUpper;
+  AVLNode<Key, Value>* match;
+  int aLowerHeight;
+  int aUpperHeight;
+  splitNodes(a, aHeight, b->getKey(), aLower, aLowerHeight, aUpper, aUpperHeight, match);
+
+  AVLNode<Key, Value>* left;
+  AVLNode<Key, Value>* right;
+  int leftHeight;
+  int rightHeight;
+  std::vector<AVLNode<Key, Value>*> rightDiscarded;
+  auto combineLower = [&]() {
+    left = combineNodes(op, aLower, aLowerHeight, bLower, bLowerHeight, leftHeight, discarded, pool);
+  };
+  auto combineUpper = [&]() {
+    right = combineNodes(op, aUpper, aUpperHeight, bUpper, bUpperHeight, rightHeight, rightDiscarded, pool);
+  };
+  if (pool != nullptr && std::min(aHeight, bHeight) >= parallelCutoffHeight) {
+    pool->parallel(combineLower, combineUpper);
+  }
+  else {
+    combineLower();
+    combineUpper();
+  }
+  discarded.insert(discarded.end(), rightDiscarded.begin(), rightDiscarded.end());
+
+  AVLNode<Key, Value>* pivot = nullptr;
+  if (op == Union) {
+    pivot = b;
+    if (match != nullptr) {
+      discarded.push_back(match);
     }
-  } 
+  }
   else {
-    if (node->getLeft() == nullptr || node->getRight() == nullptr) {
-      delete node;
-      return nullptr;
-    }
-    else if (node->getLeft() == nullptr) {
-      AVLNode<Key, Value>* rightC = node->getRight();
-      rightC->setParent(node->getParent());
-      delete node;
-      return rightC;
-    }
-    else if (node->getRight() == nullptr) {
-      AVLNode<Key, Value>* leftC = node->getLeft();
-      leftC->setParent(node->getParent());
-      delete node;
-      return leftC;
+    discarded.push_back(b);
+    if (op == Intersection) {
+      pivot = match;
+    }
+    else if (match != nullptr) {
+      discarded.push_back(match);
+    }
+  }
+  this->chainSubtrees(left, pivot, right);
+  if (pivot == nullptr) {
+    return joinNodes(left, right, leftHeight, rightHeight, height);
+  }
+  return joinNodes(left, pivot, right, leftHeight, rightHeight, height);
+}
+
+/**
+ * Inserts the pairs in [first, last), overwriting values already there.
+ * The batch is sorted and turned into detached nodes, then merged in by
+ * one descent: each node the batch reaches splits the batch around its
+ * key, its subtrees take their share, and it is joined back to them,
+ * which is a plain relink unless their heights moved apart. New keys
+ * that land in an empty spot are hung there as a balanced subtree.
+ */
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+void AVLTree<Key, Value, Compare>::insert_batch(ForwardIt first, ForwardIt last, ThreadPool* pool)
+{
+    std::vector<AVLNode<Key, Value>*> nodes;
+    std::size_t count = 0;
+    if (this->isStrictlySorted(first, last, count)) {
+      nodes.reserve(count);
+      for (ForwardIt it = first; it != last; ++it) {
+        nodes.push_back(this->template createNode<AVLNode<Key, Value> >(it->first, it->second, nullptr));
+      }
     }
     else {
-      AVLNode<Key, Value>* pred = findPredecessorAVL(node);
-      nodeSwap(node, pred);
-      node->setLeft(removeRecursive(node->getLeft(), key));
-      if (node->getLeft() != nullptr) {
-        node->getLeft()->setParent(node);
+      std::vector<std::pair<Key, Value> > items = this->sortedItems(first, last);
+      nodes.reserve(items.size());
+      for (std::size_t i = 0; i < items.size(); ++i) {
+        nodes.push_back(this->template createNode<AVLNode<Key, Value> >(
+            std::move(items[i].first), std::move(items[i].second), nullptr));
       }
     }
-  }
 
-  return balance(node);
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    this->root_ = nullptr;
+    std::vector<AVLNode<Key, Value>*> duplicates;
+    int height;
+    root = insertNodes(root, heightOf(root), nodes, 0, nodes.size(), height, duplicates, pool);
+    for (std::size_t i = 0; i < duplicates.size(); ++i) {
+      this->destroyNode(duplicates[i]);
+    }
+
+    this->root_ = root;
+    this->rightmost_ = root;
+    while (this->rightmost_ != nullptr && this->rightmost_->getRight() != nullptr) {
+      this->rightmost_ = this->rightmost_->getRight();
+    }
+    if (root != nullptr) {
+      this->chainNodes(nullptr, this->getSmallestNode());
+      this->chainNodes(this->rightmost_, nullptr);
+    }
+    this->size_ += nodes.size() - duplicates.size();
 }
 
-template <class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::findPredecessorAVL(AVLNode<Key, Value>* node) {
-  AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(node->getLeft());
-  while (current->getRight() != nullptr) {
-    current = static_cast<AVLNode<Key, Value>*>(current->getRight());
+/**
+ * Removes the keys in [first, last), skipping any that are not there,
+ * with the same kind of descent as insert_batch(). A node whose key is
+ * in the batch is dropped and its two remaining subtrees are joined.
+ */
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+void AVLTree<Key, Value, Compare>::erase_batch(ForwardIt first, ForwardIt last, ThreadPool* pool)
+{
+    if (this->root_ == nullptr) {
+      return;
+    }
+    std::vector<Key> keys(first, last);
+    const Compare& comp = this->comp_;
+    std::sort(keys.begin(), keys.end(), comp);
+    keys.erase(std::unique(keys.begin(), keys.end(),
+                           [&comp](const Key& a, const Key& b) { return !comp(a, b); }),
+               keys.end());
+
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    this->root_ = nullptr;
+    std::vector<AVLNode<Key, Value>*> erased;
+    int height;
+    root = eraseKeys(root, heightOf(root), keys, 0, keys.size(), height, erased, pool);
+    for (std::size_t i = 0; i < erased.size(); ++i) {
+      this->unthreadNode(erased[i]);
+      this->destroyNode(erased[i]);
+    }
+
+    this->root_ = root;
+    this->rightmost_ = root;
+    while (this->rightmost_ != nullptr && this->rightmost_->getRight() != nullptr) {
+      this->rightmost_ = this->rightmost_->getRight();
+    }
+    this->size_ -= erased.size();
+}
+
+/**
+ * Links the sorted, detached nodes[lo, hi) into a balanced subtree and
+ * reports its height, like buildSubtree() but with nodes already made.
+ * Under BST_THREADED the subtree comes back chained in order.
+ */
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::linkBatch(const std::vector<AVLNode<Key, Value>*>& nodes,
+    std::size_t lo, std::size_t hi, int& height)
+{
+  if (lo == hi) {
+    height = 0;
+    return nullptr;
   }
-  return current;
+  std::size_t mid = lo + (hi - lo) / 2;
+  int leftHeight;
+  int rightHeight;
+  AVLNode<Key, Value>* left = linkBatch(nodes, lo, mid, leftHeight);
+  AVLNode<Key, Value>* right = linkBatch(nodes, mid + 1, hi, rightHeight);
+  this->chainSubtrees(left, nodes[mid], right);
+  return joinNodes(left, nodes[mid], right, leftHeight, rightHeight, height);
 }
 
-template <class Key, class Value>
-int AVLTree<Key, Value>::getBalanceFactor(AVLNode<Key, Value>* node) {
+/**
+ * Merges the sorted, detached nodes[lo, hi) into a detached subtree of
+ * known height and returns the result with its height. A batch node
+ * whose key is already present gives up its value and goes on
+ * duplicates. The two sides are independent, so they run in parallel
+ * once both the subtree and the batch are big enough; nodes are only
+ * relinked, never allocated or freed, on the way. Under BST_THREADED
+ * each join also chains its seams, so the result is chained in order.
+ */
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::insertNodes(AVLNode<Key, Value>* node, int nodeHeight,
+    const std::vector<AVLNode<Key, Value>*>& nodes, std::size_t lo, std::size_t hi, int& height,
+    std::vector<AVLNode<Key, Value>*>& duplicates, ThreadPool* pool)
+{
+  if (lo == hi) {
+    height = nodeHeight;
+    return node;
+  }
   if (node == nullptr) {
-    return 0;
+    return linkBatch(nodes, lo, hi, height);
+  }
+  AVLNode<Key, Value>* lower = node->getLeft();
+  AVLNode<Key, Value>* upper = node->getRight();
+  int lowerHeight = nodeHeight - (node->getBalance() > 0 ? 2 : 1);
+  int upperHeight = nodeHeight - (node->getBalance() < 0 ? 2 : 1);
+  if (lower != nullptr) {
+    lower->setParent(nullptr);
   }
-  return getHeight(static_cast<AVLNode<Key, Value>*>(node->getLeft())) - getHeight(static_cast<AVLNode<Key, Value>*>(node->getRight()));
+  if (upper != nullptr) {
+    upper->setParent(nullptr);
+  }
+
+  const Compare& comp = this->comp_;
+  std::size_t split = std::lower_bound(nodes.begin() + lo, nodes.begin() + hi, node,
+      [&comp](const AVLNode<Key, Value>* a, const AVLNode<Key, Value>* b) {
+        return comp(a->getKey(), b->getKey());
+      }) - nodes.begin();
+  std::size_t upperLo = split;
+  if (split < hi && !comp(node->getKey(), nodes[split]->getKey())) {
+    node->setValue(std::move(nodes[split]->getValue()));
+    duplicates.push_back(nodes[split]);
+    upperLo++;
+  }
+
+  AVLNode<Key, Value>* left;
+  AVLNode<Key, Value>* right;
+  int leftHeight;
+  int rightHeight;
+  std::vector<AVLNode<Key, Value>*> rightDuplicates;
+  auto insertLower = [&]() {
+    left = insertNodes(lower, lowerHeight, nodes, lo, split, leftHeight, duplicates, pool);
+  };
+  auto insertUpper = [&]() {
+    right = insertNodes(upper, upperHeight, nodes, upperLo, hi, rightHeight, rightDuplicates, pool);
+  };
+  if (pool != nullptr && nodeHeight >= parallelCutoffHeight && hi - lo >= parallelCutoffBatch) {
+    pool->parallel(insertLower, insertUpper);
+  }
+  else {
+    insertLower();
+    insertUpper();
+  }
+  duplicates.insert(duplicates.end(), rightDuplicates.begin(), rightDuplicates.end());
+  this->chainSubtrees(left, node, right);
+  return joinNodes(left, node, right, leftHeight, rightHeight, height);
 }
 
-template <class Key, class Value>
-int AVLTree<Key, Value>::getHeight(AVLNode<Key, Value>* node) {
-  if (node == nullptr) {
-    return -1;
+/**
+ * Removes the sorted keys[lo, hi) from a detached subtree of known
+ * height and returns what is left with its height, adding the removed
+ * nodes to erased. Runs in parallel under the same rule as
+ * insertNodes().
+ */
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::eraseKeys(AVLNode<Key, Value>* node, int nodeHeight,
+    const std::vector<Key>& keys, std::size_t lo, std::size_t hi, int& height,
+    std::vector<AVLNode<Key, Value>*>& erased, ThreadPool* pool)
+{
+  if (node == nullptr || lo == hi) {
+    height = nodeHeight;
+    return node;
+  }
+  AVLNode<Key, Value>* lower = node->getLeft();
+  AVLNode<Key, Value>* upper = node->getRight();
+  int lowerHeight = nodeHeight - (node->getBalance() > 0 ? 2 : 1);
+  int upperHeight = nodeHeight - (node->getBalance() < 0 ? 2 : 1);
+  if (lower != nullptr) {
+    lower->setParent(nullptr);
   }
-  
-  int leftH = getHeight(node->getLeft());
-  int rightH = getHeight(node->getRight());
-  if (leftH > rightH) {
-    return 1 + leftH;
+  if (upper != nullptr) {
+    upper->setParent(nullptr);
+  }
+
+  std::size_t split = std::lower_bound(keys.begin() + lo, keys.begin() + hi, node->getKey(), this->comp_) -
+                      keys.begin();
+  std::size_t upperLo = split;
+  bool found = split < hi && !this->comp_(node->getKey(), keys[split]);
+  if (found) {
+    erased.push_back(node);
+    upperLo++;
+  }
+
+  AVLNode<Key, Value>* left;
+  AVLNode<Key, Value>* right;
+  int leftHeight;
+  int rightHeight;
+  std::vector<AVLNode<Key, Value>*> rightErased;
+  auto eraseLower = [&]() {
+    left = eraseKeys(lower, lowerHeight, keys, lo, split, leftHeight, erased, pool);
+  };
+  auto eraseUpper = [&]() {
+    right = eraseKeys(upper, upperHeight, keys, upperLo, hi, rightHeight, rightErased, pool);
+  };
+  if (pool != nullptr && nodeHeight >= parallelCutoffHeight && hi - lo >= parallelCutoffBatch) {
+    pool->parallel(eraseLower, eraseUpper);
   }
   else {
-    return 1 + rightH;
+    eraseLower();
+    eraseUpper();
   }
+  erased.insert(erased.end(), rightErased.begin(), rightErased.end());
+  if (found) {
+    return joinNodes(left, right, leftHeight, rightHeight, height);
+  }
+  return joinNodes(left, node, right, leftHeight, rightHeight, height);
 }
 
-template <class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* node) {
+/**
+ * Walks up from the parent of a removed node, where diff is the change to
+ * that node's balance. Stops as soon as a subtree keeps its old height.
+ */
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::removeFix(AVLNode<Key, Value>* node, int8_t diff) {
+  while (node != nullptr) {
+    // work out the next step before a rotation moves node down
+    AVLNode<Key, Value>* parent = node->getParent();
+    int8_t nextDiff = 0;
+    if (parent != nullptr) {
+      nextDiff = (node == parent->getLeft()) ? 1 : -1;
+    }
+
+    node->updateBalance(diff);
+    if (node->getBalance() == 1 || node->getBalance() == -1) {
+      // the taller side is still there, so the height did not change
+      return;
+    }
+    if (node->getBalance() != 0) {
+      // a rotation leaves the subtree one shorter unless the heavy child
+      // was perfectly balanced, in which case the new root leans over
+      if (balance(node)->getBalance() != 0) {
+        return;
+      }
+    }
+    node = parent;
+    diff = nextDiff;
+  }
+}
+
+/**
+* Bulk built nodes get their balance straight from the subtree heights,
+* so assign() needs no rebalancing pass.
+*/
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::noteHeights(Node<Key, Value>* node, int leftHeight, int rightHeight)
+{
+    static_cast<AVLNode<Key, Value>*>(node)->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+}
+
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::findPredecessorAVL(AVLNode<Key, Value>* node) {
+  AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(node->getLeft());
+  while (current->getRight() != nullptr) {
+    current = static_cast<AVLNode<Key, Value>*>(current->getRight());
+  }
+  return current;
+}
+
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::rotateLeft(AVLNode<Key, Value>* node) {
   AVLNode<Key, Value>* y = node->getRight();
   AVLNode<Key, Value>* t2 = y->getLeft();
 
@@ -304,15 +1144,18 @@ AVLNode<Key, Value>* AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* node)
       y->getParent()->setRight(y);
     }
   }
-  else {
+  else if (this->root_ == node) {
     this->root_ = y;
   }
 
+  // node is now y's child, so its size has to be redone first
+  this->recount(node);
+  this->recount(y);
   return y;
 }
 
-template <class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* node) {
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::rotateRight(AVLNode<Key, Value>* node) {
   AVLNode<Key, Value>* y = node->getLeft();
   AVLNode<Key, Value>* t2 = y->getRight();
 
@@ -334,44 +1177,87 @@ AVLNode<Key, Value>* AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* node)
       y->getParent()->setRight(y);
     }
   }
-  else {
+  else if (this->root_ == node) {
     this->root_ = y;
   }
 
+  // node is now y's child, so its size has to be redone first
+  this->recount(node);
+  this->recount(y);
   return y;
 }
 
-template <class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::balance(AVLNode<Key, Value>* node) {
+/**
+ * Restores a node whose balance has reached +/-2 with a single or double
+ * rotation and returns the new subtree root. Balances are right height
+ * minus left height; the new values follow from the old balances of the
+ * nodes involved, so no subtree is ever re-measured.
+ */
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::balance(AVLNode<Key, Value>* node) {
   if (node == nullptr) {
     return node;
   }
 
-  int balanceFactor = getBalanceFactor(node);
-
-  if (balanceFactor > 1) {
-    if (getBalanceFactor(static_cast<AVLNode<Key, Value>*>(node->getLeft())) < 0) {
-      node->setLeft(rotateLeft(static_cast<AVLNode<Key, Value>*>(node->getLeft())));
+  if (node->getBalance() < -1) {
+    AVLNode<Key, Value>* child = node->getLeft();
+    if (child->getBalance() <= 0) {
+      // zig-zig: single rotation
+      AVLNode<Key, Value>* root = rotateRight(node);
+      if (child->getBalance() == 0) {
+        node->setBalance(-1);
+        child->setBalance(1);
+      }
+      else {
+        node->setBalance(0);
+        child->setBalance(0);
+      }
+      return root;
     }
-    return rotateRight(node);
+    // zig-zag: double rotation around the grandchild
+    AVLNode<Key, Value>* grand = child->getRight();
+    int8_t gb = grand->getBalance();
+    rotateLeft(child);
+    rotateRight(node);
+    node->setBalance(gb == -1 ? 1 : 0);
+    child->setBalance(gb == 1 ? -1 : 0);
+    grand->setBalance(0);
+    return grand;
   }
 
-  if (balanceFactor < -1) {
-    if (getBalanceFactor(static_cast<AVLNode<Key, Value>*>(node->getRight())) > 0) {
-      node->setRight(rotateRight(static_cast<AVLNode<Key, Value>*>(node->getRight())));
+  if (node->getBalance() > 1) {
+    AVLNode<Key, Value>* child = node->getRight();
+    if (child->getBalance() >= 0) {
+      AVLNode<Key, Value>* root = rotateLeft(node);
+      if (child->getBalance() == 0) {
+        node->setBalance(1);
+        child->setBalance(-1);
+      }
+      else {
+        node->setBalance(0);
+        child->setBalance(0);
+      }
+      return root;
     }
-    return rotateLeft(node);
+    AVLNode<Key, Value>* grand = child->getLeft();
+    int8_t gb = grand->getBalance();
+    rotateRight(child);
+    rotateLeft(node);
+    node->setBalance(gb == 1 ? -1 : 0);
+    child->setBalance(gb == -1 ? 1 : 0);
+    grand->setBalance(0);
+    return grand;
   }
 
   return node;
 }
 
 
-template<class Key, class Value>
-//void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
-void AVLTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<class Key, class Value, class Compare>
+//void AVLTree<Key, Value, Compare>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+void AVLTree<Key, Value, Compare>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Compare>::nodeSwap(n1, n2);
     AVLNode<Key, Value>* avlN1 = static_cast<AVLNode<Key, Value>*>(n1);
     AVLNode<Key, Value>* avlN2 = static_cast<AVLNode<Key, Value>*>(n2);
     int8_t tempB = avlN1->getBalance();
@@ -384,5 +1270,16 @@ void AVLTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
     */
 }
 
+/**
+* Runs the AVLNode destructor before handing the memory back to the pool.
+*/
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::destroyNode(Node<Key,Value>* node)
+{
+    AVLNode<Key, Value>* avlNode = static_cast<AVLNode<Key, Value>*>(node);
+    avlNode->~AVLNode();
+    this->pool_.deallocate(avlNode);
+}
+
 
 #endif
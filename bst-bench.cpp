@@ -0,0 +1,754 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+#include "frozen_tree.h"
+#include "eytzinger.h"
+#include "snapshot.h"
+#include "compactbst.h"
+#include "concurrent_avl.h"
+#include "persistent_avl.h"
+#include "btree.h"
+#include "disk_tree.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+double msSince(Clock::time_point start)
+{
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+void report(const char* label, double ms, size_t ops)
+{
+    cout << "  " << left << setw(32) << label << right << setw(10) << fixed << setprecision(1)
+         << ms << " ms" << setw(10) << setprecision(1) << (ms * 1e6 / ops) << " ns/op" << endl;
+}
+
+// Node churn: fill, remove half, refill the holes, then tear down.
+void benchAllocation(size_t n)
+{
+#ifdef BST_NO_NODE_POOL
+    cout << "AVLTree node churn, global new/delete (" << n << " keys)" << endl;
+#else
+    cout << "AVLTree node churn, pooled nodes (" << n << " keys)" << endl;
+#endif
+    vector<uint64_t> keys(n);
+    mt19937_64 rng(104);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+    }
+
+    AVLTree<uint64_t, uint64_t> tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("insert", msSince(start), n);
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; i += 2) {
+        tree.remove(keys[i]);
+    }
+    report("remove every other key", msSince(start), n / 2);
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; i += 2) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("reinsert removed keys", msSince(start), n / 2);
+
+    start = Clock::now();
+    tree.clear();
+    report("clear", msSince(start), n);
+}
+
+// Lookups and a full scan with the same keys in both storage modes.
+template<typename Tree>
+void benchLookups(const char* name, const vector<uint64_t>& keys)
+{
+    cout << name << " (" << keys.size() << " keys)" << endl;
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("insert", msSince(start), keys.size());
+
+    uint64_t sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        sum += tree.find(keys[i])->second;
+    }
+    report("find", msSince(start), keys.size());
+
+    start = Clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        sum += it->second;
+    }
+    report("iterate", msSince(start), keys.size());
+
+    if(sum == 42) {
+        cout << "(unlikely checksum)" << endl;
+    }
+}
+
+// Loading a sorted snapshot: one insert per key against the O(n) bulk build.
+void benchBulkLoad(size_t n)
+{
+    cout << "AVLTree load from sorted input (" << n << " keys)" << endl;
+    vector<pair<uint64_t, uint64_t> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(i * 3, i);
+    }
+
+    Clock::time_point start = Clock::now();
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(items[i]);
+        }
+        report("insert loop", msSince(start), n);
+    }
+
+    start = Clock::now();
+    {
+        AVLTree<uint64_t, uint64_t> tree(items.begin(), items.end());
+        report("bulk load", msSince(start), n);
+    }
+}
+
+// Time-ordered streams: plain inserts, inserts hinted with end(), and
+// std::map with the same hint for reference.
+void benchAppendStream(const char* name, const vector<uint64_t>& keys)
+{
+    cout << name << " (" << keys.size() << " keys)" << endl;
+    Clock::time_point start = Clock::now();
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < keys.size(); ++i) {
+            tree.insert(make_pair(keys[i], keys[i]));
+        }
+        report("AVLTree insert", msSince(start), keys.size());
+    }
+
+    start = Clock::now();
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < keys.size(); ++i) {
+            tree.insert(tree.end(), make_pair(keys[i], keys[i]));
+        }
+        report("AVLTree insert(end(), ...)", msSince(start), keys.size());
+    }
+
+    start = Clock::now();
+    {
+        map<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < keys.size(); ++i) {
+            tree.insert(tree.end(), make_pair(keys[i], keys[i]));
+        }
+        report("std::map insert(end(), ...)", msSince(start), keys.size());
+    }
+}
+
+void benchAppends(size_t n)
+{
+    vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = i;
+    }
+    benchAppendStream("Sequential keys", keys);
+
+    // every 16th key arrives up to 8 places late
+    mt19937_64 rng(9);
+    for(size_t i = 0; i + 8 < n; i += 16) {
+        swap(keys[i], keys[i + 1 + rng() % 8]);
+    }
+    benchAppendStream("Nearly sorted keys", keys);
+}
+
+// Teardown of trees whose values need destructors, so clear() has to
+// visit every node: a balanced AVLTree and a BinarySearchTree fed sorted
+// keys, which leaves it a single path n nodes deep.
+template<typename Tree>
+void benchTeardownOf(const char* label, size_t n)
+{
+    Tree tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(uint64_t(i), string("v")));
+    }
+    Clock::time_point start = Clock::now();
+    tree.clear();
+    report(label, msSince(start), n);
+}
+
+void benchTeardown(size_t n)
+{
+    cout << "clear() with string values (" << n << " keys)" << endl;
+    benchTeardownOf<AVLTree<uint64_t, string> >("balanced AVLTree", n);
+    benchTeardownOf<BinarySearchTree<uint64_t, string> >("degenerate BinarySearchTree", n);
+}
+
+// Merging two trees of n keys that share a third of them: inserting one
+// tree's entries into the other, then each set operation run serially and
+// on pools of more and more threads.
+typedef AVLTree<uint64_t, uint64_t> SetOpTree;
+
+string threadCount(unsigned threads)
+{
+    return to_string(threads) + (threads == 1 ? " thread" : " threads");
+}
+
+void benchSetOperation(const char* label, void (SetOpTree::*op)(SetOpTree&, ThreadPool*),
+                       const vector<pair<uint64_t, uint64_t> >& a, const vector<pair<uint64_t, uint64_t> >& b,
+                       ThreadPool* pool)
+{
+    SetOpTree first(a.begin(), a.end());
+    SetOpTree second(b.begin(), b.end());
+    Clock::time_point start = Clock::now();
+    (first.*op)(second, pool);
+    report(label, msSince(start), a.size() + b.size());
+}
+
+void benchSetOperations(size_t n)
+{
+    cout << "AVLTree set operations (2 x " << n << " keys)" << endl;
+    vector<pair<uint64_t, uint64_t> > a(n);
+    vector<pair<uint64_t, uint64_t> > b(n);
+    for(size_t i = 0; i < n; ++i) {
+        a[i] = make_pair(i * 2, i);
+        b[i] = make_pair(i * 3, i);
+    }
+
+    {
+        SetOpTree first(a.begin(), a.end());
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            first.insert(b[i]);
+        }
+        report("insert loop", msSince(start), 2 * n);
+    }
+    benchSetOperation("union_with, serial", &SetOpTree::union_with, a, b, NULL);
+
+    unsigned cores = max(thread::hardware_concurrency(), 1u);
+    for(unsigned threads = 1; ; threads = min(threads * 2, cores)) {
+        ThreadPool pool(threads);
+        benchSetOperation(("union_with, " + threadCount(threads)).c_str(), &SetOpTree::union_with, a, b, &pool);
+        if(threads == cores) {
+            benchSetOperation("intersect_with, serial", &SetOpTree::intersect_with, a, b, NULL);
+            benchSetOperation(("intersect_with, " + threadCount(threads)).c_str(),
+                              &SetOpTree::intersect_with, a, b, &pool);
+            benchSetOperation("difference_with, serial", &SetOpTree::difference_with, a, b, NULL);
+            benchSetOperation(("difference_with, " + threadCount(threads)).c_str(),
+                              &SetOpTree::difference_with, a, b, &pool);
+            break;
+        }
+    }
+}
+
+// Lookups mixed with inserts and removes from several threads, against
+// AVLTree behind one mutex, which is what callers had to do before.
+struct LockedAVLTree
+{
+    bool find(uint64_t key, uint64_t& value)
+    {
+        lock_guard<mutex> guard(lock);
+        AVLTree<uint64_t, uint64_t>::iterator it = tree.find(key);
+        if(it == tree.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+    void insert(const pair<const uint64_t, uint64_t>& item)
+    {
+        lock_guard<mutex> guard(lock);
+        tree.insert(item);
+    }
+    void remove(uint64_t key)
+    {
+        lock_guard<mutex> guard(lock);
+        tree.remove(key);
+    }
+
+    mutex lock;
+    AVLTree<uint64_t, uint64_t> tree;
+};
+
+template<typename Map>
+void benchMixOf(const char* name, size_t n, unsigned threads, unsigned writePercent)
+{
+    Map map;
+    for(size_t i = 0; i < n; i += 2) {
+        map.insert(make_pair(uint64_t(i), uint64_t(i)));
+    }
+
+    size_t perThread = n / threads;
+    vector<thread> workers;
+    Clock::time_point start = Clock::now();
+    for(unsigned t = 0; t < threads; ++t) {
+        workers.push_back(thread([&map, n, perThread, writePercent, t]() {
+            mt19937_64 rng(t + 1);
+            uint64_t value = 0;
+            uint64_t sum = 0;
+            for(size_t i = 0; i < perThread; ++i) {
+                uint64_t r = rng();
+                uint64_t key = r % n;
+                if((r >> 40) % 100 >= writePercent) {
+                    if(map.find(key, value)) {
+                        sum += value;
+                    }
+                } else if(r & (1 << 20)) {
+                    map.insert(make_pair(key, key));
+                } else {
+                    map.remove(key);
+                }
+            }
+            // keep the lookups from being optimized away
+            if(sum == 1) {
+                cout << "";
+            }
+        }));
+    }
+    for(unsigned t = 0; t < threads; ++t) {
+        workers[t].join();
+    }
+    report((threadCount(threads) + ", " + name).c_str(), msSince(start), perThread * threads);
+}
+
+void benchConcurrency(size_t n)
+{
+    unsigned cores = max(thread::hardware_concurrency(), 1u);
+    const unsigned writePercents[] = { 0, 10, 50 };
+    for(size_t w = 0; w < sizeof(writePercents) / sizeof(writePercents[0]); ++w) {
+        cout << "Shared tree, " << writePercents[w] << "% writes (" << n << " ops over " << n / 2
+             << " keys)" << endl;
+        for(unsigned threads = 1; ; threads = min(threads * 2, cores)) {
+            benchMixOf<LockedAVLTree>("AVLTree + mutex", n, threads, writePercents[w]);
+            benchMixOf<ConcurrentAVLTree<uint64_t, uint64_t> >("ConcurrentAVLTree", n, threads,
+                                                               writePercents[w]);
+            if(threads == cores) {
+                break;
+            }
+        }
+    }
+}
+
+// Batches of random keys against a tree of n: a loop of insert() or
+// remove() calls against one insert_batch() or erase_batch() merge.
+void benchBatch(const vector<pair<uint64_t, uint64_t> >& items, size_t batchSize)
+{
+    vector<pair<uint64_t, uint64_t> > batch(batchSize);
+    vector<uint64_t> keys(batchSize);
+    mt19937_64 rng(batchSize);
+    for(size_t i = 0; i < batchSize; ++i) {
+        // every other key is already in the tree
+        uint64_t key = (i % 2) ? items[rng() % items.size()].first : rng();
+        batch[i] = make_pair(key, i);
+        keys[i] = key;
+    }
+    string size = " (" + to_string(batchSize) + " keys)";
+
+    AVLTree<uint64_t, uint64_t> tree(items.begin(), items.end());
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < batchSize; ++i) {
+        tree.insert(batch[i]);
+    }
+    report(("insert loop" + size).c_str(), msSince(start), batchSize);
+    start = Clock::now();
+    for(size_t i = 0; i < batchSize; ++i) {
+        tree.remove(keys[i]);
+    }
+    report(("remove loop" + size).c_str(), msSince(start), batchSize);
+
+    AVLTree<uint64_t, uint64_t> batched(items.begin(), items.end());
+    start = Clock::now();
+    batched.insert_batch(batch.begin(), batch.end());
+    report(("insert_batch" + size).c_str(), msSince(start), batchSize);
+    start = Clock::now();
+    batched.erase_batch(keys.begin(), keys.end());
+    report(("erase_batch" + size).c_str(), msSince(start), batchSize);
+}
+
+void benchBatches(size_t n)
+{
+    cout << "AVLTree batched updates (" << n << " keys in the tree)" << endl;
+    vector<pair<uint64_t, uint64_t> > items(n);
+    mt19937_64 rng(20);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(rng(), i);
+    }
+    benchBatch(items, n / 1000);
+    benchBatch(items, n / 100);
+    benchBatch(items, n / 10);
+}
+
+// Point-in-time views while writes keep coming: a full copy of an
+// AVLTree against an O(1) snapshot of a PersistentAVLTree, and what the
+// snapshots do to the cost of later inserts.
+void benchSnapshots(size_t n)
+{
+    cout << "Snapshots (" << n << " keys)" << endl;
+    vector<uint64_t> keys(n);
+    mt19937_64 rng(19);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+    }
+
+    AVLTree<uint64_t, uint64_t> tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("AVLTree insert", msSince(start), n);
+
+    PersistentAVLTree<uint64_t, uint64_t> persistent;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        persistent.insert(make_pair(keys[i], keys[i]));
+    }
+    report("PersistentAVLTree insert", msSince(start), n);
+
+    start = Clock::now();
+    {
+        PersistentAVLTree<uint64_t, uint64_t> view;
+        for(size_t i = 0; i < n; ++i) {
+            if(i % 1000 == 0) {
+                view = persistent.snapshot();
+            }
+            persistent.insert(make_pair(keys[i] + 1, keys[i]));
+        }
+        report("  ...with a snapshot per 1000", msSince(start), n);
+    }
+
+    start = Clock::now();
+    {
+        AVLTree<uint64_t, uint64_t> copy(tree.begin(), tree.end());
+        report("AVLTree full copy", msSince(start), n);
+    }
+    start = Clock::now();
+    {
+        PersistentAVLTree<uint64_t, uint64_t> view = persistent.snapshot();
+        report("PersistentAVLTree snapshot()", msSince(start), n);
+    }
+}
+
+// Snapshot files: writing one, loading it back into a tree through the
+// bulk build, and answering lookups straight from the mapped file. The
+// file was just written, so it is read from the page cache.
+void benchSnapshotFiles(size_t n)
+{
+    cout << "Snapshot files (" << n << " keys)" << endl;
+    const char* path = "bst-bench.snapshot";
+    vector<uint64_t> keys(n);
+    mt19937_64 rng(24);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+    }
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point start = Clock::now();
+    save(tree, path);
+    report("save()", msSince(start), n);
+    tree.clear();
+
+    start = Clock::now();
+    load(tree, path);
+    report("load()", msSince(start), n);
+    shuffle(keys.begin(), keys.end(), rng);
+
+    uint64_t sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += tree.find(keys[i])->second;
+    }
+    report("AVLTree find", msSince(start), n);
+    tree.clear();
+
+    start = Clock::now();
+    {
+        MappedSnapshot<uint64_t, uint64_t> snapshot(path);
+        report("MappedSnapshot open", msSince(start), n);
+
+        start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            uint64_t value = 0;
+            snapshot.find(keys[i], value);
+            sum += value;
+        }
+        report("MappedSnapshot find", msSince(start), n);
+    }
+    remove(path);
+
+    if(sum == 42) {
+        cout << "(unlikely checksum)" << endl;
+    }
+}
+
+// Lookups in a tree that no longer changes: the pointer tree itself, a
+// plain binary search over the sorted items, and a frozen copy whose
+// search keys are in van Emde Boas order.
+void benchFrozen(size_t n)
+{
+    cout << "Frozen lookups (" << n << " keys)" << endl;
+    vector<uint64_t> keys(n);
+    mt19937_64 rng(21);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+    }
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point start = Clock::now();
+    FrozenTree<uint64_t, uint64_t> frozen = freeze(tree);
+    report("freeze()", msSince(start), n);
+    shuffle(keys.begin(), keys.end(), rng);
+
+    uint64_t sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += tree.find(keys[i])->second;
+    }
+    report("AVLTree find", msSince(start), n);
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += lower_bound(frozen.begin(), frozen.end(), keys[i],
+                           [](const pair<const uint64_t, uint64_t>& item, uint64_t key) {
+                               return item.first < key;
+                           })->second;
+    }
+    report("sorted array binary search", msSince(start), n);
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += frozen.find(keys[i])->second;
+    }
+    report("FrozenTree find", msSince(start), n);
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += frozen.lower_bound(keys[i])->second;
+    }
+    report("FrozenTree lower_bound", msSince(start), n);
+
+    start = Clock::now();
+    for(FrozenTree<uint64_t, uint64_t>::iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        sum += it->second;
+    }
+    report("FrozenTree iterate", msSince(start), n);
+
+    if(sum == 42) {
+        cout << "(unlikely checksum)" << endl;
+    }
+}
+
+// Lookups in a tree flattened into breadth-first order: one search at a
+// time, then batches of searches run side by side.
+void benchEytzinger(size_t n)
+{
+    cout << "Eytzinger lookups (" << n << " keys)" << endl;
+    vector<uint64_t> keys(n);
+    mt19937_64 rng(22);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+    }
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point start = Clock::now();
+    EytzingerArray<uint64_t, uint64_t> flat = toEytzinger(tree);
+    report("toEytzinger()", msSince(start), n);
+    shuffle(keys.begin(), keys.end(), rng);
+
+    uint64_t sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += tree.find(keys[i])->second;
+    }
+    report("AVLTree find", msSince(start), n);
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += *flat.find(keys[i]);
+    }
+    report("EytzingerArray find", msSince(start), n);
+
+    vector<const uint64_t*> found(n);
+    start = Clock::now();
+    flat.find(keys.data(), n, found.data());
+    for(size_t i = 0; i < n; ++i) {
+        sum += *found[i];
+    }
+    report(flat.vectorized() ? "batch find, AVX2" : "batch find, scalar", msSince(start), n);
+
+    if(sum == 42) {
+        cout << "(unlikely checksum)" << endl;
+    }
+}
+
+template<typename Tree>
+void removeKey(Tree& tree, uint64_t key)
+{
+    tree.remove(key);
+}
+
+void removeKey(map<uint64_t, uint64_t>& tree, uint64_t key)
+{
+    tree.erase(key);
+}
+
+// The same random workload against each map engine: binary trees with
+// one key per node, the wide-node B-tree, and std::map for reference.
+template<typename Tree>
+void benchEngine(const char* name, vector<uint64_t> keys)
+{
+    cout << name << " (" << keys.size() << " keys)" << endl;
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("insert", msSince(start), keys.size());
+
+    mt19937_64 rng(23);
+    shuffle(keys.begin(), keys.end(), rng);
+    uint64_t sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        sum += tree.find(keys[i])->second;
+    }
+    report("find", msSince(start), keys.size());
+
+    start = Clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        sum += it->second;
+    }
+    report("iterate", msSince(start), keys.size());
+
+    start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        removeKey(tree, keys[i]);
+    }
+    report("remove", msSince(start), keys.size());
+
+    if(sum == 42) {
+        cout << "(unlikely checksum)" << endl;
+    }
+}
+
+void benchEngines(size_t n)
+{
+    vector<uint64_t> keys(n);
+    mt19937_64 rng(23);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+    }
+    benchEngine<BinarySearchTree<uint64_t, uint64_t> >("Engine: BinarySearchTree", keys);
+    benchEngine<AVLTree<uint64_t, uint64_t> >("Engine: AVLTree", keys);
+    benchEngine<BTreeMap<uint64_t, uint64_t> >("Engine: BTreeMap", keys);
+    benchEngine<map<uint64_t, uint64_t> >("Engine: std::map", keys);
+}
+
+// One pass of inserts and then lookups against a DiskTree whose cache
+// holds cacheBytes of pages, with the cache's hit rate for the lookups.
+void benchDiskTreeWith(const char* label, const vector<uint64_t>& keys, size_t cacheBytes)
+{
+    const char* path = "bst-bench.disktree";
+    remove(path);
+    vector<uint64_t> order(keys);
+    mt19937_64 rng(25);
+    shuffle(order.begin(), order.end(), rng);
+    uint64_t sum = 0;
+    {
+        DiskTree<uint64_t, uint64_t> tree(path, cacheBytes);
+        string name = string(label) + " insert";
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < keys.size(); ++i) {
+            tree.insert(make_pair(keys[i], keys[i]));
+        }
+        tree.flush();
+        report(name.c_str(), msSince(start), keys.size());
+
+        tree.resetCacheStats();
+        name = string(label) + " find";
+        start = Clock::now();
+        for(size_t i = 0; i < order.size(); ++i) {
+            sum += tree.find(order[i])->second;
+        }
+        report(name.c_str(), msSince(start), order.size());
+        BufferPool::Stats stats = tree.cacheStats();
+        cout << "  " << left << setw(32) << "  page hit rate" << right << setw(10) << setprecision(1)
+             << (100.0 * stats.hits / (stats.hits + stats.misses)) << " %" << endl;
+    }
+    remove(path);
+
+    if(sum == 42) {
+        cout << "(unlikely checksum)" << endl;
+    }
+}
+
+// A tree kept in a file: with a cache a tenth the size of the data, and
+// with one big enough for all of it.
+void benchDiskTree(size_t n)
+{
+    cout << "DiskTree (" << n << " keys)" << endl;
+    vector<uint64_t> keys(n);
+    mt19937_64 rng(26);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+    }
+    benchDiskTreeWith("cache 1/10 of data:", keys, n * 2 * sizeof(uint64_t) / 10);
+    benchDiskTreeWith("cache holds all:", keys, n * 4 * sizeof(uint64_t));
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 1000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    benchAllocation(n);
+    benchBulkLoad(n);
+    benchAppends(n);
+    benchTeardown(n);
+    benchSetOperations(n);
+    benchBatches(n);
+    benchConcurrency(n);
+    benchSnapshots(n);
+    benchSnapshotFiles(n);
+    benchFrozen(n);
+    benchEytzinger(n);
+    benchEngines(n);
+    benchDiskTree(n);
+
+    vector<uint64_t> keys(n);
+    mt19937_64 rng(2024);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+    }
+#ifdef BST_THREADED
+    benchLookups<AVLTree<uint64_t, uint64_t> >("AVLTree, pointer links, threaded", keys);
+#else
+    benchLookups<AVLTree<uint64_t, uint64_t> >("AVLTree, pointer links", keys);
+#endif
+    benchLookups<CompactAVLTree<uint64_t, uint64_t> >("CompactAVLTree, 32-bit index links", keys);
+
+    return 0;
+}
@@ -5,20 +5,76 @@
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <functional>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <tuple>
+#include "node_pool.h"
+
+/**
+ * Builds the key/value pair for a new node. The trees pick the node type
+ * through a virtual makeNode(), which cannot take arbitrary constructor
+ * arguments, so those arguments travel behind this interface instead.
+ * build() returns the pair by value, and the node initialises its item
+ * straight from that result, so nothing is built twice.
+ */
+template <typename Key, typename Value>
+class ItemBuilder
+{
+public:
+    virtual std::pair<const Key, Value> build() = 0;
+
+protected:
+    ~ItemBuilder() {}
+};
+
+/**
+ * An ItemBuilder around a function object that returns the pair.
+ * itemBuilder<Key, Value>(fn) makes one.
+ */
+template <typename Key, typename Value, typename Fn>
+class ItemFrom : public ItemBuilder<Key, Value>
+{
+public:
+    explicit ItemFrom(Fn fn) : fn_(std::move(fn)) {}
+    virtual std::pair<const Key, Value> build() override { return fn_(); }
+
+private:
+    Fn fn_;
+};
+
+template <typename Key, typename Value, typename Fn>
+ItemFrom<Key, Value, Fn> itemBuilder(Fn fn)
+{
+    return ItemFrom<Key, Value, Fn>(std::move(fn));
+}
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * Nothing here is virtual, so nodes carry no vtable and every
+ * link access can be inlined. Node types for other kinds of
+ * search trees, such as Red Black trees, Splay trees, and AVL
+ * trees, derive from Node and hide the parent/left/right getters
+ * with versions that return their own type. A tree only ever
+ * holds one node type, so those casts are always safe.
+ *
+ * Define BST_ORDER_STATISTICS to give every node the size of its
+ * subtree, which the trees use for select() and rank().
+ *
+ * Define BST_THREADED to also chain every node to its in-order
+ * neighbours, so stepping an iterator is O(1) in the worst case
+ * instead of a climb through parent pointers.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
-    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    template<typename K, typename V>
+    Node(K&& key, V&& value, Node<Key, Value>* parent);
+    Node(ItemBuilder<Key, Value>& builder, Node<Key, Value>* parent);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,20 +82,39 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
+
+#ifdef BST_ORDER_STATISTICS
+    std::size_t getCount() const;
+    void setCount(std::size_t count);
+#endif
+#ifdef BST_THREADED
+    Node<Key, Value>* getPrev() const;
+    Node<Key, Value>* getNext() const;
+    void setPrev(Node<Key, Value>* prev);
+    void setNext(Node<Key, Value>* next);
+#endif
 
 protected:
     std::pair<const Key, Value> item_;
     Node<Key, Value>* parent_;
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
+#ifdef BST_ORDER_STATISTICS
+    std::size_t count_;
+#endif
+#ifdef BST_THREADED
+    Node<Key, Value>* prev_;
+    Node<Key, Value>* next_;
+#endif
 };
 
 /*
@@ -49,14 +124,43 @@ protected:
 */
 
 /**
-* Explicit constructor for a node.
+* Explicit constructor for a node. The key and value are forwarded
+* straight into the stored pair, so temporaries are moved, not copied.
+*/
+template<typename Key, typename Value>
+template<typename K, typename V>
+Node<Key, Value>::Node(K&& key, V&& value, Node<Key, Value>* parent) :
+    item_(std::forward<K>(key), std::forward<V>(value)),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+#ifdef BST_ORDER_STATISTICS
+    , count_(1)
+#endif
+#ifdef BST_THREADED
+    , prev_(NULL)
+    , next_(NULL)
+#endif
+{
+
+}
+
+/**
+* Builds the item in place from whatever builder returns.
 */
 template<typename Key, typename Value>
-Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
-    item_(key, value),
+Node<Key, Value>::Node(ItemBuilder<Key, Value>& builder, Node<Key, Value>* parent) :
+    item_(builder.build()),
     parent_(parent),
     left_(NULL),
     right_(NULL)
+#ifdef BST_ORDER_STATISTICS
+    , count_(1)
+#endif
+#ifdef BST_THREADED
+    , prev_(NULL)
+    , next_(NULL)
+#endif
 {
 
 }
@@ -118,7 +222,7 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
@@ -127,7 +231,7 @@ Node<Key, Value>* Node<Key, Value>::getParent() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -136,7 +240,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -180,6 +284,73 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+/**
+* A setter that moves the new value in.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setValue(Value&& value)
+{
+    item_.second = std::move(value);
+}
+
+#ifdef BST_ORDER_STATISTICS
+/**
+* A getter for the number of nodes in this node's subtree, itself included.
+*/
+template<typename Key, typename Value>
+std::size_t Node<Key, Value>::getCount() const
+{
+    return count_;
+}
+
+/**
+* A setter for the subtree size.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setCount(std::size_t count)
+{
+    count_ = count;
+}
+#endif
+
+#ifdef BST_THREADED
+/**
+* A getter for the node just before this one in key order.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::getPrev() const
+{
+    return prev_;
+}
+
+/**
+* A getter for the node just after this one in key order.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::getNext() const
+{
+    return next_;
+}
+
+/**
+* A setter for the previous node in key order.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setPrev(Node<Key, Value>* prev)
+{
+    prev_ = prev;
+}
+
+/**
+* A setter for the next node in key order.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setNext(Node<Key, Value>* next)
+{
+    next_ = next;
+}
+#endif
+
 /*
   ---------------------------------------
   End implementations for the Node class.
@@ -189,28 +360,60 @@ void Node<Key, Value>::setValue(const Value& value)
 /**
 * A templated unbalanced binary search tree.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Compare = std::less<Key> >
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    explicit BinarySearchTree(const Compare& comp);
+    template<typename ForwardIt>
+    BinarySearchTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
     virtual ~BinarySearchTree(); //TODO
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    template<typename ForwardIt>
+    void assign(ForwardIt first, ForwardIt last);
+    void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
     virtual void remove(const Key& key); //TODO
     void clear(); //TODO
     bool isBalanced() const; //TODO
+
+    /**
+    * A structural health report. Height counts nodes on the longest
+    * root-to-leaf path; leaf depths count edges from the root. balanced
+    * says whether every node's subtrees differ in height by at most one,
+    * which is the AVL invariant.
+    */
+    struct TreeStats
+    {
+        std::size_t nodeCount;
+        int height;
+        int minLeafDepth;
+        int maxLeafDepth;
+        bool balanced;
+    };
+    TreeStats stats() const;
     void print() const;
     bool empty() const;
+    std::size_t size() const;
+    Compare key_comp() const;
 
     template<typename PPKey, typename PPValue>
     friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
 public:
+    class const_iterator;
+
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * It is bidirectional: decrementing end() lands on the largest item.
     */
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -220,17 +423,117 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, Compare>;
+        friend class const_iterator;
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value, Compare>* tree);
+        Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value, Compare>* tree_;
+    };
+
+    /**
+    * A read-only iterator, handed out by const trees. Any iterator
+    * converts to one.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
+        friend class BinarySearchTree<Key, Value, Compare>;
+        const_iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value, Compare>* tree);
         Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value, Compare>* tree_;
     };
 
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
-    iterator begin() const;
-    iterator end() const;
-    iterator find(const Key& key) const;
+    iterator begin();
+    const_iterator begin() const;
+    iterator end();
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin();
+    const_reverse_iterator rbegin() const;
+    reverse_iterator rend();
+    const_reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator find(const K& key) const;
+
+    // Ordered queries, each a single walk down from the root.
+    // for_each_in_range() calls fn on every entry with lo <= key < hi.
+    iterator lower_bound(const Key& key);
+    const_iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key);
+    const_iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key);
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const;
+    template<typename Fn>
+    void for_each_in_range(const Key& lo, const Key& hi, Fn fn) const;
+
+    // Move-aware insertion. insert() overwrites an existing value like the
+    // const& version; emplace() and try_emplace() leave it alone.
+    template<typename P, typename = typename std::enable_if<
+        std::is_constructible<std::pair<const Key, Value>, P&&>::value>::type>
+    void insert(P&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+
+    // Hinted insertion with std::map semantics: the new entry goes just
+    // before hint when that is where it belongs, and an existing value is
+    // left alone. Passing end() makes appending increasing keys cheap.
+    iterator insert(const_iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    template<typename P, typename = typename std::enable_if<
+        std::is_constructible<std::pair<const Key, Value>, P&&>::value>::type>
+    iterator insert(const_iterator hint, P&& keyValuePair);
+
+#ifdef BST_ORDER_STATISTICS
+    // Order statistics in O(log n): the k-th smallest entry (from 0, end()
+    // when k >= size()) and the number of keys less than key.
+    iterator select(std::size_t k);
+    const_iterator select(std::size_t k) const;
+    std::size_t rank(const Key& key) const;
+#endif
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
@@ -247,14 +550,81 @@ protected:
     virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
 
     // Add helper functions here
-    int getHeight(Node<Key,Value> *n) const;
-    bool isBalancedRecursive(Node<Key, Value>* node) const;
-    void clearRecursive(Node<Key, Value>* node);
+    template<typename K>
+    Node<Key, Value>* lookup(const K& key) const;
+    Node<Key, Value>* lowerBoundNode(const Key& key) const;
+    Node<Key, Value>* upperBoundNode(const Key& key) const;
+    std::pair<Node<Key, Value>*, Node<Key, Value>*> equalRangeNodes(const Key& key) const;
+#ifdef BST_ORDER_STATISTICS
+    Node<Key, Value>* selectNode(std::size_t k) const;
+#endif
+    std::size_t destroySubtree(Node<Key, Value>* node);
     static Node<Key, Value>* successor(Node<Key, Value>* node);
 
+    // Node storage. Derived trees with bigger nodes pass their node size
+    // to the protected constructor, build nodes with createNode<T>() and
+    // override destroyNode() to run their own node destructor.
+    BinarySearchTree(std::size_t nodeSize, const Compare& comp);
+    template<typename NodeType, typename K, typename V>
+    NodeType* createNode(K&& key, V&& value, NodeType* parent);
+    template<typename NodeType>
+    NodeType* createNode(ItemBuilder<Key, Value>& builder, NodeType* parent);
+    virtual void destroyNode(Node<Key, Value>* node);
+
+    // Insertion steps shared by every insert flavour. makeNode() builds the
+    // tree's own node type and rebalanceAfterInsert() lets a balanced tree
+    // fix itself up once the new node is linked in. assign() builds through
+    // makeNode() too, and hands each node its subtree heights through
+    // noteHeights(). Callers go through buildNode(), which hands makeNode()
+    // an ItemBuilder around fn so that every item is built in place.
+    // makeNode() is the only virtual that touches Value, so a tree of a
+    // move-only type never needs Value's copy constructor.
+    template<typename K>
+    Node<Key, Value>* findSlot(const K& key, Node<Key, Value>*& parent, bool& goLeft) const;
+    template<typename K>
+    Node<Key, Value>* findSlotNear(Node<Key, Value>* hint, const K& key, Node<Key, Value>*& parent, bool& goLeft) const;
+    void linkNode(Node<Key, Value>* parent, bool goLeft, Node<Key, Value>* node);
+    virtual Node<Key, Value>* makeNode(Node<Key, Value>* parent, ItemBuilder<Key, Value>& builder);
+    template<typename Fn>
+    Node<Key, Value>* buildNode(Node<Key, Value>* parent, Fn fn);
+    virtual void rebalanceAfterInsert(Node<Key, Value>* node);
+    virtual void noteHeights(Node<Key, Value>* node, int leftHeight, int rightHeight);
+
+    // Subtree size upkeep. These do nothing unless BST_ORDER_STATISTICS
+    // is defined, so callers need no #ifdefs of their own.
+    static void recount(Node<Key, Value>* node);
+    static void addToCounts(Node<Key, Value>* node, int delta);
+
+    // In-order chain upkeep, likewise empty unless BST_THREADED is defined.
+    // Rotations keep the key order, so only these four places touch it.
+    static void threadNode(Node<Key, Value>* node);
+    static void unthreadNode(Node<Key, Value>* node);
+    static void swapThreads(Node<Key, Value>* n1, Node<Key, Value>* n2);
+    static void threadSubtree(Node<Key, Value>* root);
+    static void chainNodes(Node<Key, Value>* before, Node<Key, Value>* after);
+    static void chainSubtrees(Node<Key, Value>* left, Node<Key, Value>* pivot, Node<Key, Value>* right);
+
+    // Bulk loading helpers
+    template<typename ForwardIt>
+    bool isStrictlySorted(ForwardIt first, ForwardIt last, std::size_t& count) const;
+    template<typename ForwardIt>
+    std::vector<std::pair<Key, Value> > sortedItems(ForwardIt first, ForwardIt last) const;
+    template<typename ForwardIt>
+    Node<Key, Value>* buildSubtree(ForwardIt& it, std::size_t count, int& height);
+
 protected:
     Node<Key, Value>* root_;
     // You should not need other data members
+    // Largest node, kept up to date by linkNode(), remove() and assign().
+    // Rotations never change which node it is.
+    Node<Key, Value>* rightmost_;
+    // Entry count, kept exact by every change except a split without
+    // BST_ORDER_STATISTICS, which sets sizeStale_ instead; size() then
+    // counts the nodes once. Changes made meanwhile may leave size_ off.
+    mutable std::size_t size_;
+    mutable bool sizeStale_;
+    NodePool pool_;
+    Compare comp_;
 };
 
 /*
@@ -265,9 +635,11 @@ Begin implementations for the BinarySearchTree::iterator class.
 
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
+* The tree is only needed to step back from end().
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr) : current_(ptr)
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator(Node<Key,Value> *ptr,
+    const BinarySearchTree<Key, Value, Compare>* tree) : current_(ptr), tree_(tree)
 {
     // TODO
 }
@@ -275,8 +647,8 @@ BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr) : current
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() : current_(nullptr)
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator() : current_(nullptr), tree_(nullptr)
 {
     // TODO
 }
@@ -284,9 +656,9 @@ BinarySearchTree<Key, Value>::iterator::iterator() : current_(nullptr)
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Compare>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -294,9 +666,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Compare>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -305,10 +677,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare>::iterator& rhs) const
 {
     // TODO
     return current_ == rhs.current_;
@@ -318,10 +690,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare>::iterator& rhs) const
 {
     // TODO
     return current_ != rhs.current_;
@@ -331,15 +703,48 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator&
+BinarySearchTree<Key, Value, Compare>::iterator::operator++()
 {
     // TODO
-    current_ = BinarySearchTree<Key, Value>::successor(current_);
+    current_ = BinarySearchTree<Key, Value, Compare>::successor(current_);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves the iterator back one item; from end() that is the largest one.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator&
+BinarySearchTree<Key, Value, Compare>::iterator::operator--()
+{
+    if (current_ == nullptr) {
+        current_ = tree_->rightmost_;
+    } else {
+        current_ = BinarySearchTree<Key, Value, Compare>::predecessor(current_);
+    }
     return *this;
 }
 
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
 
 /*
 -------------------------------------------------------------
@@ -347,6 +752,109 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/*
+--------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::const_iterator class.
+--------------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::const_iterator::const_iterator(Node<Key,Value> *ptr,
+    const BinarySearchTree<Key, Value, Compare>* tree) : current_(ptr), tree_(tree)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::const_iterator::const_iterator() : current_(nullptr), tree_(nullptr)
+{
+
+}
+
+/**
+* Lets a mutable iterator be used wherever a read-only one is expected.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::const_iterator::const_iterator(const iterator& it) :
+    current_(it.current_), tree_(it.tree_)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return current_->getItem();
+}
+
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &(current_->getItem());
+}
+
+template<class Key, class Value, class Compare>
+bool
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare>::const_iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<class Key, class Value, class Compare>
+bool
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare>::const_iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    current_ = BinarySearchTree<Key, Value, Compare>::successor(current_);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    if (current_ == nullptr) {
+        current_ = tree_->rightmost_;
+    } else {
+        current_ = BinarySearchTree<Key, Value, Compare>::predecessor(current_);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+------------------------------------------------------------------
+End implementations for the BinarySearchTree::const_iterator class.
+------------------------------------------------------------------
+*/
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -356,14 +864,66 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() : root_(nullptr)
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree() :
+    root_(nullptr),
+    rightmost_(nullptr),
+    size_(0),
+    sizeStale_(false),
+    pool_(sizeof(Node<Key, Value>)),
+    comp_()
 {
     // TODO
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Constructor that orders keys with the given comparison object.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(const Compare& comp) :
+    root_(nullptr),
+    rightmost_(nullptr),
+    size_(0),
+    sizeStale_(false),
+    pool_(sizeof(Node<Key, Value>)),
+    comp_(comp)
+{
+
+}
+
+/**
+* Builds a balanced tree from the pairs in [first, last). See assign().
+*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    root_(nullptr),
+    rightmost_(nullptr),
+    size_(0),
+    sizeStale_(false),
+    pool_(sizeof(Node<Key, Value>)),
+    comp_(comp)
+{
+    assign(first, last);
+}
+
+/**
+* Constructor for derived trees whose nodes are larger than a Node.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(std::size_t nodeSize, const Compare& comp) :
+    root_(nullptr),
+    rightmost_(nullptr),
+    size_(0),
+    sizeStale_(false),
+    pool_(nodeSize),
+    comp_(comp)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+BinarySearchTree<Key, Value, Compare>::~BinarySearchTree()
 {
     // TODO
     clear();
@@ -372,14 +932,41 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Compare>
+bool BinarySearchTree<Key, Value, Compare>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+/**
+ * Returns the number of entries in the tree. This is O(1) except for the
+ * first call after a split that left the count stale, which walks the
+ * tree once in O(n).
+*/
+template<class Key, class Value, class Compare>
+std::size_t BinarySearchTree<Key, Value, Compare>::size() const
+{
+    if (sizeStale_) {
+        size_ = 0;
+        for (Node<Key, Value>* node = getSmallestNode(); node != nullptr; node = successor(node)) {
+            size_++;
+        }
+        sizeStale_ = false;
+    }
+    return size_;
+}
+
+/**
+ * Returns a copy of the object used to order keys
+*/
+template<class Key, class Value, class Compare>
+Compare BinarySearchTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::print() const
 {
     printRoot(root_);
     std::cout << "\n";
@@ -388,109 +975,924 @@ void BinarySearchTree<Key, Value>::print() const
 /**
 * Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::begin()
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
+    BinarySearchTree<Key, Value, Compare>::iterator begin(getSmallestNode(), this);
     return begin;
 }
 
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(getSmallestNode(), this);
+}
+
 /**
 * Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::end()
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    BinarySearchTree<Key, Value, Compare>::iterator end(NULL, this);
     return end;
 }
 
-/**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
-*/
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::end() const
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    return const_iterator(NULL, this);
 }
 
-/**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::cbegin() const
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    return begin();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::cend() const
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    return end();
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Reverse iterators start from the largest item.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rbegin()
 {
-    // TODO
-    if (root_ == nullptr) {
-        root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
-        return;
-    }
-
-    Node<Key, Value>* current = root_;
-    Node<Key, Value>* parent = nullptr;
-    while (current != nullptr) {
-        parent = current;
-        if (keyValuePair.first < current->getKey()) {
-            current = current->getLeft();
-        } else if (keyValuePair.first > current->getKey()) {
-            current = current->getRight();
-        } else {
-            // Key already exists, update the value
-            current->setValue(keyValuePair.second);
-            return;
-        }
-    }
+    return reverse_iterator(end());
+}
 
-    Node<Key, Value>* newNode = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent);
-    if (keyValuePair.first < parent->getKey()) {
-        parent->setLeft(newNode);
-    } else {
-        parent->setRight(newNode);
-    }
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rbegin() const
+{
+    return const_reverse_iterator(end());
 }
 
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rend()
+{
+    return reverse_iterator(begin());
+}
 
-/**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
-*/
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::crbegin() const
+{
+    return rbegin();
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::crend() const
+{
+    return rend();
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const Key & k)
+{
+    Node<Key, Value> *curr = internalFind(k);
+    BinarySearchTree<Key, Value, Compare>::iterator it(curr, this);
+    return it;
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::find(const Key & k) const
+{
+    return const_iterator(internalFind(k), this);
+}
+
+/**
+* Heterogeneous version of find(), available when Compare is transparent
+* (declares is_transparent, like std::less<>). The key is compared as-is,
+* e.g. a string_view against std::string keys, without building a Key.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const K& k)
+{
+    BinarySearchTree<Key, Value, Compare>::iterator it(lookup(k), this);
+    return it;
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::find(const K& k) const
+{
+    return const_iterator(lookup(k), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or the end iterator if there is none.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const Key& key)
+{
+    return iterator(lowerBoundNode(key), this);
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return const_iterator(lowerBoundNode(key), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or the end iterator if there is none.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const Key& key)
+{
+    return iterator(upperBoundNode(key), this);
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return const_iterator(upperBoundNode(key), this);
+}
+
+/**
+* Returns lower_bound(key) and upper_bound(key), found together.
+*/
+template<class Key, class Value, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator,
+          typename BinarySearchTree<Key, Value, Compare>::iterator>
+BinarySearchTree<Key, Value, Compare>::equal_range(const Key& key)
+{
+    std::pair<Node<Key, Value>*, Node<Key, Value>*> range = equalRangeNodes(key);
+    return std::make_pair(iterator(range.first, this), iterator(range.second, this));
+}
+
+template<class Key, class Value, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::const_iterator,
+          typename BinarySearchTree<Key, Value, Compare>::const_iterator>
+BinarySearchTree<Key, Value, Compare>::equal_range(const Key& key) const
+{
+    std::pair<Node<Key, Value>*, Node<Key, Value>*> range = equalRangeNodes(key);
+    return std::make_pair(const_iterator(range.first, this), const_iterator(range.second, this));
+}
+
+/**
+* The descent behind lower_bound(): the last node not below key on the way
+* down is the first one in order.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::lowerBoundNode(const Key& key) const
+{
+    Node<Key, Value>* bound = nullptr;
+    Node<Key, Value>* current = root_;
+    while (current != nullptr) {
+        if (comp_(current->getKey(), key)) {
+            current = current->getRight();
+        } else {
+            bound = current;
+            current = current->getLeft();
+        }
+    }
+    return bound;
+}
+
+/**
+* The descent behind upper_bound().
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::upperBoundNode(const Key& key) const
+{
+    Node<Key, Value>* bound = nullptr;
+    Node<Key, Value>* current = root_;
+    while (current != nullptr) {
+        if (comp_(key, current->getKey())) {
+            bound = current;
+            current = current->getLeft();
+        } else {
+            current = current->getRight();
+        }
+    }
+    return bound;
+}
+
+/**
+* Both ends of equal_range() from one descent. Keys are unique, so the
+* range holds at most one item; when it is found, the upper end is the
+* leftmost node of its right subtree if it has one.
+*/
+template<class Key, class Value, class Compare>
+std::pair<Node<Key, Value>*, Node<Key, Value>*>
+BinarySearchTree<Key, Value, Compare>::equalRangeNodes(const Key& key) const
+{
+    Node<Key, Value>* upper = nullptr;
+    Node<Key, Value>* current = root_;
+    while (current != nullptr) {
+        if (comp_(key, current->getKey())) {
+            upper = current;
+            current = current->getLeft();
+        } else if (comp_(current->getKey(), key)) {
+            current = current->getRight();
+        } else {
+            Node<Key, Value>* next = current->getRight();
+            if (next != nullptr) {
+                while (next->getLeft() != nullptr) {
+                    next = next->getLeft();
+                }
+                upper = next;
+            }
+            return std::make_pair(current, upper);
+        }
+    }
+    return std::make_pair(upper, upper);
+}
+
+/**
+* Visits every item with lo <= key < hi in order, in O(log n + k).
+* Subtrees entirely below lo are never entered and the walk stops at the
+* first key not below hi. Pending nodes are kept on an explicit stack
+* instead of climbing back up through parent pointers, so the depth of
+* an unbalanced tree cannot overflow the call stack either.
+*/
+template<class Key, class Value, class Compare>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Compare>::for_each_in_range(const Key& lo, const Key& hi, Fn fn) const
+{
+    std::vector<Node<Key, Value>*> pending;
+    Node<Key, Value>* current = root_;
+    while (true) {
+        while (current != nullptr) {
+            if (comp_(current->getKey(), lo)) {
+                current = current->getRight();
+            } else {
+                pending.push_back(current);
+                current = current->getLeft();
+            }
+        }
+        if (pending.empty()) {
+            return;
+        }
+        current = pending.back();
+        pending.pop_back();
+        if (!comp_(current->getKey(), hi)) {
+            return;
+        }
+        fn(current->getItem());
+        current = current->getRight();
+    }
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+Value& BinarySearchTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value, class Compare>
+Value const & BinarySearchTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    // TODO
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlot(keyValuePair.first, parent, goLeft);
+    if (existing != nullptr) {
+        // Key already exists, update the value
+        existing->setValue(keyValuePair.second);
+        return;
+    }
+    linkNode(parent, goLeft, buildNode(parent, [&]() {
+        return std::pair<const Key, Value>(keyValuePair);
+    }));
+}
+
+/**
+* Inserts anything a key/value pair can be built from (such as the result
+* of std::make_pair). The node is built from it in place before the
+* search, since its key is only known then; if the key is already present
+* the new value is moved over the old one and the node is dropped.
+*/
+template<class Key, class Value, class Compare>
+template<typename P, typename>
+void BinarySearchTree<Key, Value, Compare>::insert(P&& keyValuePair)
+{
+    Node<Key, Value>* node = buildNode(nullptr, [&]() {
+        return std::pair<const Key, Value>(std::forward<P>(keyValuePair));
+    });
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlot(node->getKey(), parent, goLeft);
+    if (existing != nullptr) {
+        existing->getValue() = std::move(node->getValue());
+        destroyNode(node);
+        return;
+    }
+    node->setParent(parent);
+    linkNode(parent, goLeft, node);
+}
+
+/**
+* Inserts the pair unless its key is already present, starting the search
+* next to hint. Returns an iterator to the entry with that key.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::insert(const_iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlotNear(hint.current_, keyValuePair.first, parent, goLeft);
+    if (existing != nullptr) {
+        return iterator(existing, this);
+    }
+    Node<Key, Value>* node = buildNode(parent, [&]() {
+        return std::pair<const Key, Value>(keyValuePair);
+    });
+    linkNode(parent, goLeft, node);
+    return iterator(node, this);
+}
+
+template<class Key, class Value, class Compare>
+template<typename P, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::insert(const_iterator hint, P&& keyValuePair)
+{
+    Node<Key, Value>* node = buildNode(nullptr, [&]() {
+        return std::pair<const Key, Value>(std::forward<P>(keyValuePair));
+    });
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlotNear(hint.current_, node->getKey(), parent, goLeft);
+    if (existing != nullptr) {
+        destroyNode(node);
+        return iterator(existing, this);
+    }
+    node->setParent(parent);
+    linkNode(parent, goLeft, node);
+    return iterator(node, this);
+}
+
+/**
+* Builds a key/value pair from args, in place in a new node, and links
+* that node in if the key is absent; otherwise the node is dropped, as
+* with std::map. Returns an iterator to the entry with that key and
+* whether it was added.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::emplace(Args&&... args)
+{
+    Node<Key, Value>* node = buildNode(nullptr, [&]() {
+        return std::pair<const Key, Value>(std::forward<Args>(args)...);
+    });
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlot(node->getKey(), parent, goLeft);
+    if (existing != nullptr) {
+        destroyNode(node);
+        return std::make_pair(iterator(existing, this), false);
+    }
+    node->setParent(parent);
+    linkNode(parent, goLeft, node);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* Inserts key with a value built in place from args, but only if the key
+* is absent; otherwise args are not touched and no value is built.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlot(key, parent, goLeft);
+    if (existing != nullptr) {
+        return std::make_pair(iterator(existing, this), false);
+    }
+    Node<Key, Value>* node = buildNode(parent, [&]() {
+        return std::pair<const Key, Value>(std::piecewise_construct,
+            std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+    });
+    linkNode(parent, goLeft, node);
+    return std::make_pair(iterator(node, this), true);
+}
+
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlot(key, parent, goLeft);
+    if (existing != nullptr) {
+        return std::make_pair(iterator(existing, this), false);
+    }
+    Node<Key, Value>* node = buildNode(parent, [&]() {
+        return std::pair<const Key, Value>(std::piecewise_construct,
+            std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+    });
+    linkNode(parent, goLeft, node);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* Inserts key with a value built in place from obj, or assigns obj to the
+* existing value. The bool is true when a new entry was added.
+*/
+template<class Key, class Value, class Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::insert_or_assign(const Key& key, M&& obj)
+{
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlot(key, parent, goLeft);
+    if (existing != nullptr) {
+        existing->getValue() = std::forward<M>(obj);
+        return std::make_pair(iterator(existing, this), false);
+    }
+    Node<Key, Value>* node = buildNode(parent, [&]() {
+        return std::pair<const Key, Value>(std::piecewise_construct,
+            std::forward_as_tuple(key), std::forward_as_tuple(std::forward<M>(obj)));
+    });
+    linkNode(parent, goLeft, node);
+    return std::make_pair(iterator(node, this), true);
+}
+
+template<class Key, class Value, class Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::insert_or_assign(Key&& key, M&& obj)
+{
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlot(key, parent, goLeft);
+    if (existing != nullptr) {
+        existing->getValue() = std::forward<M>(obj);
+        return std::make_pair(iterator(existing, this), false);
+    }
+    Node<Key, Value>* node = buildNode(parent, [&]() {
+        return std::pair<const Key, Value>(std::piecewise_construct,
+            std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<M>(obj)));
+    });
+    linkNode(parent, goLeft, node);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* Finds where key belongs. Returns the node already holding key, or NULL
+* with parent/goLeft describing the empty link a new node should take.
+* One comparison per level: go right on "not less", remembering the
+* last such node, which is the only one that can hold an equal key.
+* A key past the largest one skips the descent entirely.
+*/
+template<class Key, class Value, class Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::findSlot(
+    const K& key, Node<Key, Value>*& parent, bool& goLeft) const
+{
+    parent = rightmost_;
+    goLeft = false;
+    if (rightmost_ == nullptr || comp_(rightmost_->getKey(), key)) {
+        return nullptr;
+    }
+    Node<Key, Value>* current = root_;
+    Node<Key, Value>* candidate = nullptr;
+    while (current != nullptr) {
+        parent = current;
+        goLeft = comp_(key, current->getKey());
+        if (goLeft) {
+            current = current->getLeft();
+        } else {
+            candidate = current;
+            current = current->getRight();
+        }
+    }
+    if (candidate != nullptr && !comp_(candidate->getKey(), key)) {
+        return candidate;
+    }
+    return nullptr;
+}
+
+/**
+* Like findSlot(), but first tries the slot right next to hint (NULL
+* meaning end()), which costs a comparison or two when the caller knows
+* where the key goes. A wrong hint falls back to a full descent.
+*/
+template<class Key, class Value, class Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::findSlotNear(
+    Node<Key, Value>* hint, const K& key, Node<Key, Value>*& parent, bool& goLeft) const
+{
+    if (hint == nullptr) {
+        return findSlot(key, parent, goLeft);
+    }
+    if (comp_(key, hint->getKey())) {
+        // belongs before hint if it also comes after hint's predecessor
+        Node<Key, Value>* before = predecessor(hint);
+        if (before == nullptr || comp_(before->getKey(), key)) {
+            goLeft = hint->getLeft() == nullptr;
+            parent = goLeft ? hint : before;
+            return nullptr;
+        }
+    } else if (comp_(hint->getKey(), key)) {
+        Node<Key, Value>* after = successor(hint);
+        if (after == nullptr || comp_(key, after->getKey())) {
+            goLeft = hint->getRight() != nullptr;
+            parent = goLeft ? after : hint;
+            return nullptr;
+        }
+    } else {
+        return hint;
+    }
+    return findSlot(key, parent, goLeft);
+}
+
+/**
+* Hangs a new node off the slot found by findSlot() and lets the tree
+* rebalance around it.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::linkNode(
+    Node<Key, Value>* parent, bool goLeft, Node<Key, Value>* node)
+{
+    if (parent == nullptr) {
+        root_ = node;
+        rightmost_ = node;
+    } else if (goLeft) {
+        parent->setLeft(node);
+    } else {
+        parent->setRight(node);
+        if (parent == rightmost_) {
+            rightmost_ = node;
+        }
+    }
+    ++size_;
+    addToCounts(parent, 1);
+    threadNode(node);
+    rebalanceAfterInsert(node);
+}
+
+/**
+* Builds a plain Node. Derived trees override this for their own node type.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::makeNode(
+    Node<Key, Value>* parent, ItemBuilder<Key, Value>& builder)
+{
+    return createNode(builder, parent);
+}
+
+/**
+* Builds the tree's own node type with the item fn returns, constructed
+* in place. fn is called at most once, and only after the node's memory
+* is in hand.
+*/
+template<class Key, class Value, class Compare>
+template<typename Fn>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::buildNode(Node<Key, Value>* parent, Fn fn)
+{
+    ItemFrom<Key, Value, Fn> builder = itemBuilder<Key, Value>(std::move(fn));
+    return makeNode(parent, builder);
+}
+
+/**
+* An unbalanced tree has nothing to fix after an insert.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::rebalanceAfterInsert(Node<Key, Value>* node)
+{
+
+}
+
+/**
+* Nor does it keep any balance information for a bulk built node.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::noteHeights(Node<Key, Value>* node, int leftHeight, int rightHeight)
+{
+
+}
+
+/**
+* Recomputes a node's subtree size from its children, after a rotation
+* has given it new ones.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::recount(Node<Key, Value>* node)
+{
+#ifdef BST_ORDER_STATISTICS
+    std::size_t count = 1;
+    if (node->getLeft() != nullptr) {
+        count += node->getLeft()->getCount();
+    }
+    if (node->getRight() != nullptr) {
+        count += node->getRight()->getCount();
+    }
+    node->setCount(count);
+#endif
+}
+
+/**
+* Adds delta to the subtree size of node and all of its ancestors, after
+* a node below them was linked in or spliced out.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::addToCounts(Node<Key, Value>* node, int delta)
+{
+#ifdef BST_ORDER_STATISTICS
+    for (; node != nullptr; node = node->getParent()) {
+        node->setCount(node->getCount() + delta);
+    }
+#endif
+}
+
+/**
+* Splices a freshly linked leaf into the chain. A left child comes right
+* before its parent and a right child right after it.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::threadNode(Node<Key, Value>* node)
+{
+#ifdef BST_THREADED
+    Node<Key, Value>* parent = node->getParent();
+    if (parent == nullptr) {
+        node->setPrev(nullptr);
+        node->setNext(nullptr);
+    } else if (parent->getLeft() == node) {
+        node->setPrev(parent->getPrev());
+        node->setNext(parent);
+    } else {
+        node->setPrev(parent);
+        node->setNext(parent->getNext());
+    }
+    if (node->getPrev() != nullptr) {
+        node->getPrev()->setNext(node);
+    }
+    if (node->getNext() != nullptr) {
+        node->getNext()->setPrev(node);
+    }
+#endif
+}
+
+/**
+* Takes a node that is leaving the tree out of the chain.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::unthreadNode(Node<Key, Value>* node)
+{
+#ifdef BST_THREADED
+    if (node->getPrev() != nullptr) {
+        node->getPrev()->setNext(node->getNext());
+    }
+    if (node->getNext() != nullptr) {
+        node->getNext()->setPrev(node->getPrev());
+    }
+#endif
+}
+
+/**
+* Trades the chain positions of two nodes, to go with nodeSwap() trading
+* their tree positions. Neighbours need care since each links the other.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::swapThreads(Node<Key, Value>* n1, Node<Key, Value>* n2)
+{
+#ifdef BST_THREADED
+    if (n2->getNext() == n1) {
+        std::swap(n1, n2);
+    }
+    Node<Key, Value>* n1p = n1->getPrev();
+    Node<Key, Value>* n1n = n1->getNext();
+    Node<Key, Value>* n2p = n2->getPrev();
+    Node<Key, Value>* n2n = n2->getNext();
+    if (n1n == n2) {
+        n2->setPrev(n1p);
+        n2->setNext(n1);
+        n1->setPrev(n2);
+        n1->setNext(n2n);
+    } else {
+        n1->setPrev(n2p);
+        n1->setNext(n2n);
+        n2->setPrev(n1p);
+        n2->setNext(n1n);
+        if (n1n != nullptr) {
+            n1n->setPrev(n2);
+        }
+        if (n2p != nullptr) {
+            n2p->setNext(n1);
+        }
+    }
+    if (n1p != nullptr) {
+        n1p->setNext(n2);
+    }
+    if (n2n != nullptr) {
+        n2n->setPrev(n1);
+    }
+#endif
+}
+
+/**
+* Makes before and after neighbours in the chain. Either may be NULL, which
+* cuts the chain at the other one.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::chainNodes(Node<Key, Value>* before, Node<Key, Value>* after)
+{
+#ifdef BST_THREADED
+    if (before != nullptr) {
+        before->setNext(after);
+    }
+    if (after != nullptr) {
+        after->setPrev(before);
+    }
+#endif
+}
+
+/**
+* Chains the largest node of left to pivot and pivot to the smallest node
+* of right, or the two straight to each other when pivot is NULL, for
+* detached subtrees about to be joined in that order. Each subtree's own
+* chain must already be right inside it. Either may be empty. Costs
+* O(height), which is what the join itself costs.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::chainSubtrees(Node<Key, Value>* left, Node<Key, Value>* pivot,
+                                                          Node<Key, Value>* right)
+{
+#ifdef BST_THREADED
+    Node<Key, Value>* before = left;
+    while (before != nullptr && before->getRight() != nullptr) {
+        before = before->getRight();
+    }
+    Node<Key, Value>* after = right;
+    while (after != nullptr && after->getLeft() != nullptr) {
+        after = after->getLeft();
+    }
+    if (pivot != nullptr) {
+        chainNodes(before, pivot);
+        chainNodes(pivot, after);
+    }
+    else {
+        chainNodes(before, after);
+    }
+#endif
+}
+
+/**
+* Chains up a subtree that was built without going through linkNode(),
+* walking it in order with an explicit stack.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::threadSubtree(Node<Key, Value>* root)
+{
+#ifdef BST_THREADED
+    std::vector<Node<Key, Value>*> pending;
+    Node<Key, Value>* last = nullptr;
+    Node<Key, Value>* current = root;
+    while (current != nullptr || !pending.empty()) {
+        while (current != nullptr) {
+            pending.push_back(current);
+            current = current->getLeft();
+        }
+        current = pending.back();
+        pending.pop_back();
+        current->setPrev(last);
+        current->setNext(nullptr);
+        if (last != nullptr) {
+            last->setNext(current);
+        }
+        last = current;
+        current = current->getRight();
+    }
+#endif
+}
+
+#ifdef BST_ORDER_STATISTICS
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::select(std::size_t k)
+{
+    return iterator(selectNode(k), this);
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::select(std::size_t k) const
+{
+    return const_iterator(selectNode(k), this);
+}
+
+/**
+* Walks down once, skipping whole left subtrees by their sizes.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::selectNode(std::size_t k) const
+{
+    Node<Key, Value>* current = root_;
+    while (current != nullptr) {
+        std::size_t leftCount = current->getLeft() ? current->getLeft()->getCount() : 0;
+        if (k < leftCount) {
+            current = current->getLeft();
+        } else if (k == leftCount) {
+            return current;
+        } else {
+            k -= leftCount + 1;
+            current = current->getRight();
+        }
+    }
+    return nullptr;
+}
+
+/**
+* Counts the keys less than key, whether or not key is in the tree.
+*/
+template<class Key, class Value, class Compare>
+std::size_t BinarySearchTree<Key, Value, Compare>::rank(const Key& key) const
+{
+    std::size_t smaller = 0;
+    Node<Key, Value>* current = root_;
+    while (current != nullptr) {
+        if (comp_(current->getKey(), key)) {
+            smaller += 1 + (current->getLeft() ? current->getLeft()->getCount() : 0);
+            current = current->getRight();
+        } else {
+            current = current->getLeft();
+        }
+    }
+    return smaller;
+}
+#endif
+
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::remove(const Key& key)
 {
     // TODO
     Node<Key, Value>* nodeToRemove = internalFind(key);
     if (nodeToRemove == nullptr) {
         return; // Key not found
     }
+    if (nodeToRemove == rightmost_) {
+        rightmost_ = predecessor(nodeToRemove);
+    }
     if (nodeToRemove->getLeft() != nullptr && nodeToRemove->getRight() != nullptr) {
         // Node has two children, swap with predecessor
         Node<Key, Value>* predecessorNode = predecessor(nodeToRemove);
@@ -515,19 +1917,145 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
     if (child != nullptr) {
         child->setParent(nodeToRemove->getParent());
     }
-    delete nodeToRemove;
+    --size_;
+    addToCounts(nodeToRemove->getParent(), -1);
+    unthreadNode(nodeToRemove);
+    destroyNode(nodeToRemove);
+}
+
+
+/**
+* Replaces the contents of the tree with the key/value pairs in
+* [first, last), building a perfectly balanced tree in O(n).
+* Input that is not strictly increasing by key is copied and sorted
+* first (O(n log n)); for repeated keys the last value wins, just as
+* with repeated inserts.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Compare>::assign(ForwardIt first, ForwardIt last)
+{
+    clear();
+    std::size_t count = 0;
+    int height = 0;
+    if (isStrictlySorted(first, last, count)) {
+        root_ = buildSubtree(first, count, height);
+    }
+    else {
+        std::vector<std::pair<Key, Value> > items = sortedItems(first, last);
+        typename std::vector<std::pair<Key, Value> >::const_iterator it = items.begin();
+        count = items.size();
+        root_ = buildSubtree(it, count, height);
+    }
+    size_ = count;
+    threadSubtree(root_);
+    rightmost_ = root_;
+    while (rightmost_ != nullptr && rightmost_->getRight() != nullptr) {
+        rightmost_ = rightmost_->getRight();
+    }
 }
 
+/**
+* Counts the range and checks that its keys strictly increase.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt>
+bool BinarySearchTree<Key, Value, Compare>::isStrictlySorted(ForwardIt first, ForwardIt last, std::size_t& count) const
+{
+    count = 0;
+    bool sorted = true;
+    ForwardIt prev = first;
+    for (ForwardIt it = first; it != last; ++it, ++count) {
+        if (count > 0 && !comp_(prev->first, it->first)) {
+            sorted = false;
+        }
+        prev = it;
+    }
+    return sorted;
+}
 
+/**
+* Copies the range, sorts it by key and keeps only the last value
+* for each key.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt>
+std::vector<std::pair<Key, Value> >
+BinarySearchTree<Key, Value, Compare>::sortedItems(ForwardIt first, ForwardIt last) const
+{
+    std::vector<std::pair<Key, Value> > items(first, last);
+    const Compare& comp = comp_;
+    std::stable_sort(items.begin(), items.end(),
+        [&comp](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) {
+            return comp(a.first, b.first);
+        });
+    std::size_t out = 0;
+    for (std::size_t i = 0; i < items.size(); ++i) {
+        if (out > 0 && !comp_(items[out - 1].first, items[i].first)) {
+            items[out - 1].second = items[i].second;
+        }
+        else {
+            if (out != i) {
+                items[out] = items[i];
+            }
+            out++;
+        }
+    }
+    items.erase(items.begin() + out, items.end());
+    return items;
+}
 
-template<class Key, class Value>
+/**
+* Builds a balanced subtree out of the next count items of a sorted
+* range, consuming them in order, and returns its root along with its
+* height. The middle item becomes the root so both sides differ in size
+* by at most one. Nodes come from makeNode(), so derived trees get their
+* own node type.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::buildSubtree(ForwardIt& it, std::size_t count, int& height)
+{
+    if (count == 0) {
+        height = 0;
+        return nullptr;
+    }
+    int leftHeight = 0;
+    int rightHeight = 0;
+    Node<Key, Value>* left = buildSubtree(it, count / 2, leftHeight);
+    Node<Key, Value>* node = buildNode(nullptr, [&]() {
+        return std::pair<const Key, Value>(it->first, it->second);
+    });
+    ++it;
+    Node<Key, Value>* right = buildSubtree(it, count - count / 2 - 1, rightHeight);
+    node->setLeft(left);
+    node->setRight(right);
+    if (left != nullptr) {
+        left->setParent(node);
+    }
+    if (right != nullptr) {
+        right->setParent(node);
+    }
+#ifdef BST_ORDER_STATISTICS
+    node->setCount(count);
+#endif
+    noteHeights(node, leftHeight, rightHeight);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return node;
+}
+
+
+template<class Key, class Value, class Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Compare>::predecessor(Node<Key, Value>* current)
 {
     // TODO
     if (current == nullptr) {
         return nullptr;
     }
+#ifdef BST_THREADED
+    return current->getPrev();
+#else
     if (current->getLeft() != nullptr) {
         current = current->getLeft();
         while (current->getRight() != nullptr) {
@@ -541,15 +2069,19 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
         parent = parent->getParent();
     }
     return parent;
+#endif
 }
 
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::successor(Node<Key, Value>* node)
+BinarySearchTree<Key, Value, Compare>::successor(Node<Key, Value>* node)
 {
     if (node == nullptr) {
         return nullptr;
     }
+#ifdef BST_THREADED
+    return node->getNext();
+#else
     if (node->getRight() != nullptr) {
         node = node->getRight();
         while (node->getLeft() != nullptr) {
@@ -564,38 +2096,110 @@ BinarySearchTree<Key, Value>::successor(Node<Key, Value>* node)
         parent = parent->getParent();
     }
     return parent;
+#endif
 }
 
 
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
+* When the pool owns the nodes and their items need no destructor,
+* the slabs are dropped wholesale without walking the tree. Nodes in
+* slabs shared with another tree are freed one by one so that it can
+* reuse their blocks.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::clear()
 {
     // TODO
-    clearRecursive(root_);
+    if (!NodePool::bulkRelease ||
+        !std::is_trivially_destructible<std::pair<const Key, Value> >::value ||
+        !pool_.exclusive()) {
+        destroySubtree(root_);
+    }
+    pool_.release();
     root_ = nullptr;
+    rightmost_ = nullptr;
+    size_ = 0;
+    sizeStale_ = false;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearRecursive(Node<Key, Value>* node)
+/**
+* Destroys every node under node without recursion or extra memory, so
+* even a tree that has degenerated into one long path is safe to drop.
+* A node with a left child is rotated right until it has none; it can
+* then be destroyed and the walk carries on down its right link. Parent
+* links are left stale since the whole subtree is going away. Returns
+* the number of nodes destroyed.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t BinarySearchTree<Key, Value, Compare>::destroySubtree(Node<Key, Value>* node)
 {
-    if (node != nullptr) {
-        clearRecursive(node->getLeft());
-        clearRecursive(node->getRight());
-        delete node;
+    std::size_t count = 0;
+    while (node != nullptr) {
+        Node<Key, Value>* left = node->getLeft();
+        if (left != nullptr) {
+            node->setLeft(left->getRight());
+            left->setRight(node);
+            node = left;
+        } else {
+            Node<Key, Value>* right = node->getRight();
+            destroyNode(node);
+            count++;
+            node = right;
+        }
     }
+    return count;
+}
+
+/**
+* Builds a node of the given type in memory taken from the pool.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename K, typename V>
+NodeType* BinarySearchTree<Key, Value, Compare>::createNode(K&& key, V&& value, NodeType* parent)
+{
+    void* block = pool_.allocate();
+    try {
+        return new (block) NodeType(std::forward<K>(key), std::forward<V>(value), parent);
+    }
+    catch (...) {
+        pool_.deallocate(block);
+        throw;
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare>::createNode(ItemBuilder<Key, Value>& builder, NodeType* parent)
+{
+    void* block = pool_.allocate();
+    try {
+        return new (block) NodeType(builder, parent);
+    }
+    catch (...) {
+        pool_.deallocate(block);
+        throw;
+    }
+}
+
+/**
+* Destroys a node and hands its memory back to the pool.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::destroyNode(Node<Key, Value>* node)
+{
+    node->~Node();
+    pool_.deallocate(node);
 }
 
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Compare>::getSmallestNode() const
 {
     // TODO
     if (root_ == nullptr) {
@@ -613,62 +2217,128 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::internalFind(const Key& key) const
 {
     // TODO
+    return lookup(key);
+}
+
+/**
+* The search behind internalFind() and the heterogeneous find(). Each
+* level costs one comp_ call; the greatest node not above the key is
+* remembered and checked for equality once, at the bottom.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::lookup(const K& key) const
+{
     Node<Key, Value>* current = root_;
+    Node<Key, Value>* candidate = nullptr;
     while (current != nullptr) {
-        if (key < current->getKey()) {
+        if (comp_(key, current->getKey())) {
             current = current->getLeft();
-        } else if (key > current->getKey()) {
-            current = current->getRight();
         } else {
-            return current; // Key found
+            candidate = current;
+            current = current->getRight();
         }
     }
+    if (candidate != nullptr && !comp_(candidate->getKey(), key)) {
+        return candidate; // Key found
+    }
     return nullptr; // Key not found
 }
 
 /**
  * Return true iff the BST is balanced.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Compare>
+bool BinarySearchTree<Key, Value, Compare>::isBalanced() const
 {
     // TODO
-    return isBalancedRecursive(root_);
+    return stats().balanced;
 }
 
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::getHeight(Node<Key, Value>* n) const
+/**
+* Gathers the TreeStats in one post-order pass, so each subtree height is
+* worked out once from its children's: O(n) time. The pass keeps its own
+* stack of pending nodes rather than recursing, so a degenerate tree
+* costs heap memory proportional to its height but never overflows.
+*/
+template<typename Key, typename Value, typename Compare>
+typename BinarySearchTree<Key, Value, Compare>::TreeStats
+BinarySearchTree<Key, Value, Compare>::stats() const
 {
-    if (n == nullptr) {
-        return 0;
+    TreeStats result;
+    result.nodeCount = 0;
+    result.height = 0;
+    result.minLeafDepth = 0;
+    result.maxLeafDepth = 0;
+    result.balanced = true;
+    if (root_ == nullptr) {
+        return result;
     }
-    int leftHeight = getHeight(n->getLeft());
-    int rightHeight = getHeight(n->getRight());
-    return std::max(leftHeight, rightHeight) + 1;
-}
 
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalancedRecursive(Node<Key, Value>* node) const
-{
-    if (node == nullptr) {
-        return true;
-    }
-    int leftHeight = getHeight(node->getLeft());
-    int rightHeight = getHeight(node->getRight());
-    if (std::abs(leftHeight - rightHeight) > 1) {
-        return false;
+    // stage 0: left subtree not visited yet, 1: right not visited yet,
+    // 2: both done and height holds the right subtree's height
+    struct Frame
+    {
+        Node<Key, Value>* node;
+        int depth;
+        int stage;
+        int leftHeight;
+    };
+    std::vector<Frame> pending;
+    Frame rootFrame = { root_, 0, 0, 0 };
+    pending.push_back(rootFrame);
+    int height = 0; // height of the subtree finished last
+    while (!pending.empty()) {
+        Frame& top = pending.back();
+        Node<Key, Value>* node = top.node;
+        if (top.stage == 0) {
+            top.stage = 1;
+            if (node->getLeft() != nullptr) {
+                Frame child = { node->getLeft(), top.depth + 1, 0, 0 };
+                pending.push_back(child);
+                continue;
+            }
+            height = 0;
+        }
+        if (top.stage == 1) {
+            top.stage = 2;
+            top.leftHeight = height;
+            if (node->getRight() != nullptr) {
+                Frame child = { node->getRight(), top.depth + 1, 0, 0 };
+                pending.push_back(child);
+                continue;
+            }
+            height = 0;
+        }
+        int leftHeight = top.leftHeight;
+        int depth = top.depth;
+        pending.pop_back();
+
+        result.nodeCount++;
+        if (std::abs(leftHeight - height) > 1) {
+            result.balanced = false;
+        }
+        if (node->getLeft() == nullptr && node->getRight() == nullptr) {
+            // post-order always finishes a leaf first
+            if (result.nodeCount == 1 || depth < result.minLeafDepth) {
+                result.minLeafDepth = depth;
+            }
+            result.maxLeafDepth = std::max(result.maxLeafDepth, depth);
+        }
+        height = 1 + std::max(leftHeight, height);
     }
-    return isBalancedRecursive(node->getLeft()) && isBalancedRecursive(node->getRight());
+    result.height = height;
+    return result;
 }
 
 
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
@@ -749,6 +2419,14 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
         this->root_ = n1;
     }
 
+#ifdef BST_ORDER_STATISTICS
+    // sizes belong to positions, so they trade places too
+    std::size_t count = n1->getCount();
+    n1->setCount(n2->getCount());
+    n2->setCount(count);
+#endif
+    swapThreads(n1, n2);
+
 }
 
 /**
@@ -0,0 +1,1122 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "node_pool.h"
+
+/**
+* What a BTreeMap's leaf and inner nodes share: a sorted run of keys kept
+* next to each other so that a search inside the node reads a few whole
+* cache lines. The slots past count hold no objects.
+*/
+template <typename Key>
+struct BTreeNode
+{
+    // about four cache lines of keys, within 16 to 64
+    static const int capacity = sizeof(Key) <= 4 ? 64 : (sizeof(Key) >= 16 ? 16 : 256 / sizeof(Key));
+
+    explicit BTreeNode(bool leaf);
+
+    Key& key(int i);
+    const Key& key(int i) const;
+
+    int count;
+    bool leaf;
+    typename std::aligned_storage<sizeof(Key), alignof(Key)>::type keys[capacity];
+};
+
+/**
+* A leaf keeps the items themselves, each key a second time in keys so
+* that searches never have to read the items, and links to its
+* neighbours for iteration.
+*/
+template <typename Key, typename Value>
+struct BTreeLeaf : BTreeNode<Key>
+{
+    BTreeLeaf();
+
+    std::pair<const Key, Value>& item(int i);
+    const std::pair<const Key, Value>& item(int i) const;
+
+    typename std::aligned_storage<sizeof(std::pair<const Key, Value>),
+                                  alignof(std::pair<const Key, Value>)>::type items[BTreeNode<Key>::capacity];
+    BTreeLeaf* prev;
+    BTreeLeaf* next;
+};
+
+/**
+* An inner node: children[i] holds the keys below key(i), and
+* children[i + 1] those from key(i) on.
+*/
+template <typename Key>
+struct BTreeInner : BTreeNode<Key>
+{
+    BTreeInner();
+
+    BTreeNode<Key>* children[BTreeNode<Key>::capacity + 1];
+};
+
+template<typename Key>
+BTreeNode<Key>::BTreeNode(bool leaf) :
+    count(0),
+    leaf(leaf)
+{
+
+}
+
+template<typename Key>
+Key& BTreeNode<Key>::key(int i)
+{
+    return *reinterpret_cast<Key*>(&keys[i]);
+}
+
+template<typename Key>
+const Key& BTreeNode<Key>::key(int i) const
+{
+    return *reinterpret_cast<const Key*>(&keys[i]);
+}
+
+template<typename Key, typename Value>
+BTreeLeaf<Key, Value>::BTreeLeaf() :
+    BTreeNode<Key>(true),
+    prev(nullptr),
+    next(nullptr)
+{
+
+}
+
+template<typename Key, typename Value>
+std::pair<const Key, Value>& BTreeLeaf<Key, Value>::item(int i)
+{
+    return *reinterpret_cast<std::pair<const Key, Value>*>(&items[i]);
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>& BTreeLeaf<Key, Value>::item(int i) const
+{
+    return *reinterpret_cast<const std::pair<const Key, Value>*>(&items[i]);
+}
+
+template<typename Key>
+BTreeInner<Key>::BTreeInner() :
+    BTreeNode<Key>(false)
+{
+
+}
+
+/**
+* A B+ tree with the same interface as AVLTree. Every node holds 16 to
+* 64 keys side by side, so a lookup reads a handful of wide nodes instead
+* of missing the cache once per comparison on the way down a binary tree.
+* Within a node, arithmetic keys are searched with a branch-free linear
+* count and other keys with a binary search.
+*
+* The items live in the leaves, which are linked in key order; iterators
+* are bidirectional. Inserting or removing may move items between nodes,
+* so either one invalidates all iterators.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class BTreeMap
+{
+public:
+    BTreeMap();
+    explicit BTreeMap(const Compare& comp);
+    ~BTreeMap();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    std::size_t size() const;
+    Compare key_comp() const;
+
+    class const_iterator;
+
+    /**
+    * An iterator over the contents in key order: a leaf and a slot in it.
+    * Decrementing end() lands on the largest item.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BTreeMap<Key, Value, Compare>;
+        friend class const_iterator;
+        iterator(BTreeLeaf<Key, Value>* leaf, int index, const BTreeMap<Key, Value, Compare>* tree);
+        BTreeLeaf<Key, Value>* leaf_;
+        int index_;
+        const BTreeMap<Key, Value, Compare>* tree_;
+    };
+
+    /**
+    * A read-only iterator, handed out by const trees. Any iterator
+    * converts to one.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class BTreeMap<Key, Value, Compare>;
+        const_iterator(BTreeLeaf<Key, Value>* leaf, int index, const BTreeMap<Key, Value, Compare>* tree);
+        BTreeLeaf<Key, Value>* leaf_;
+        int index_;
+        const BTreeMap<Key, Value, Compare>* tree_;
+    };
+
+    iterator begin();
+    const_iterator begin() const;
+    iterator end();
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key);
+    const_iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key);
+    const_iterator upper_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    typedef BTreeNode<Key> Node;
+    typedef BTreeLeaf<Key, Value> Leaf;
+    typedef BTreeInner<Key> Inner;
+
+    static const int capacity = Node::capacity;
+    // fewest keys in any node but the root; a full inner node splits
+    // into halves of this size and one more
+    static const int minCount = (capacity - 1) / 2;
+
+    int lowerIndex(const Node* node, const Key& key) const;
+    int upperIndex(const Node* node, const Key& key) const;
+    Leaf* findLeaf(const Key& key) const;
+    Leaf* boundLeaf(const Key& key, bool upper, int& index) const;
+
+    Leaf* createLeaf();
+    Inner* createInner();
+    void destroyLeaf(Leaf* leaf);
+    void destroyInner(Inner* inner);
+    void destroySubtree(Node* node);
+
+    template<typename Item>
+    static void leafInsert(Leaf* leaf, int pos, Item&& item);
+    static void leafErase(Leaf* leaf, int pos);
+    static void innerInsert(Inner* inner, int pos, const Key& key, Node* right);
+    static void innerErase(Inner* inner, int pos);
+
+    void splitChild(Inner* parent, int i);
+    int fixChild(Inner* parent, int i);
+    void mergeChildren(Inner* parent, int i);
+
+    Node* root_;
+    Leaf* first_;
+    Leaf* last_;
+    std::size_t size_;
+    NodePool leafPool_;
+    NodePool innerPool_;
+    Compare comp_;
+};
+
+/*
+-----------------------------------------------------
+Begin implementations for the BTreeMap::iterator class.
+-----------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+BTreeMap<Key, Value, Compare>::iterator::iterator() :
+    leaf_(nullptr),
+    index_(0),
+    tree_(nullptr)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+BTreeMap<Key, Value, Compare>::iterator::iterator(BTreeLeaf<Key, Value>* leaf, int index,
+                                                  const BTreeMap<Key, Value, Compare>* tree) :
+    leaf_(leaf),
+    index_(index),
+    tree_(tree)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value>& BTreeMap<Key, Value, Compare>::iterator::operator*() const
+{
+    return leaf_->item(index_);
+}
+
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value>* BTreeMap<Key, Value, Compare>::iterator::operator->() const
+{
+    return &(leaf_->item(index_));
+}
+
+template<class Key, class Value, class Compare>
+bool BTreeMap<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+template<class Key, class Value, class Compare>
+bool BTreeMap<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::iterator&
+BTreeMap<Key, Value, Compare>::iterator::operator++()
+{
+    if (++index_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::iterator
+BTreeMap<Key, Value, Compare>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::iterator&
+BTreeMap<Key, Value, Compare>::iterator::operator--()
+{
+    if (leaf_ == nullptr) {
+        leaf_ = tree_->last_;
+        index_ = leaf_->count - 1;
+    }
+    else if (index_ == 0) {
+        leaf_ = leaf_->prev;
+        index_ = leaf_->count - 1;
+    }
+    else {
+        index_--;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::iterator
+BTreeMap<Key, Value, Compare>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+---------------------------------------------------
+End implementations for the BTreeMap::iterator class.
+---------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------------
+Begin implementations for the BTreeMap::const_iterator class.
+-----------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+BTreeMap<Key, Value, Compare>::const_iterator::const_iterator() :
+    leaf_(nullptr),
+    index_(0),
+    tree_(nullptr)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+BTreeMap<Key, Value, Compare>::const_iterator::const_iterator(const iterator& it) :
+    leaf_(it.leaf_),
+    index_(it.index_),
+    tree_(it.tree_)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+BTreeMap<Key, Value, Compare>::const_iterator::const_iterator(BTreeLeaf<Key, Value>* leaf, int index,
+                                                              const BTreeMap<Key, Value, Compare>* tree) :
+    leaf_(leaf),
+    index_(index),
+    tree_(tree)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value>& BTreeMap<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return leaf_->item(index_);
+}
+
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value>* BTreeMap<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &(leaf_->item(index_));
+}
+
+template<class Key, class Value, class Compare>
+bool BTreeMap<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+template<class Key, class Value, class Compare>
+bool BTreeMap<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::const_iterator&
+BTreeMap<Key, Value, Compare>::const_iterator::operator++()
+{
+    if (++index_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::const_iterator
+BTreeMap<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::const_iterator&
+BTreeMap<Key, Value, Compare>::const_iterator::operator--()
+{
+    if (leaf_ == nullptr) {
+        leaf_ = tree_->last_;
+        index_ = leaf_->count - 1;
+    }
+    else if (index_ == 0) {
+        leaf_ = leaf_->prev;
+        index_ = leaf_->count - 1;
+    }
+    else {
+        index_--;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::const_iterator
+BTreeMap<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+---------------------------------------------------------
+End implementations for the BTreeMap::const_iterator class.
+---------------------------------------------------------
+*/
+
+/*
+-------------------------------------------
+Begin implementations for the BTreeMap class.
+-------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+BTreeMap<Key, Value, Compare>::BTreeMap() :
+    root_(nullptr),
+    first_(nullptr),
+    last_(nullptr),
+    size_(0),
+    leafPool_(sizeof(Leaf)),
+    innerPool_(sizeof(Inner)),
+    comp_()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+BTreeMap<Key, Value, Compare>::BTreeMap(const Compare& comp) :
+    root_(nullptr),
+    first_(nullptr),
+    last_(nullptr),
+    size_(0),
+    leafPool_(sizeof(Leaf)),
+    innerPool_(sizeof(Inner)),
+    comp_(comp)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+BTreeMap<Key, Value, Compare>::~BTreeMap()
+{
+    clear();
+}
+
+/**
+* Inserts the pair, or overwrites the value if the key is already there.
+* Full nodes met on the way down are split before stepping into them, so
+* there is always room for the separator a split pushes up.
+*/
+template<class Key, class Value, class Compare>
+void BTreeMap<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    const Key& key = keyValuePair.first;
+    if (root_ == nullptr) {
+        Leaf* leaf = createLeaf();
+        root_ = first_ = last_ = leaf;
+    }
+    if (root_->count == capacity) {
+        Inner* root = createInner();
+        root->children[0] = root_;
+        root_ = root;
+        splitChild(root, 0);
+    }
+    Node* node = root_;
+    while (!node->leaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        int i = upperIndex(inner, key);
+        if (inner->children[i]->count == capacity) {
+            splitChild(inner, i);
+            if (!comp_(key, inner->key(i))) {
+                i++;
+            }
+        }
+        node = inner->children[i];
+    }
+    Leaf* leaf = static_cast<Leaf*>(node);
+    int pos = lowerIndex(leaf, key);
+    if (pos < leaf->count && !comp_(key, leaf->key(pos))) {
+        leaf->item(pos).second = keyValuePair.second;
+        return;
+    }
+    leafInsert(leaf, pos, keyValuePair);
+    size_++;
+}
+
+/**
+* Removes key if it is there. On the way down, a child left with the
+* fewest keys allowed first takes one from a sibling or merges with it,
+* so that taking a key out below never leaves a node short.
+*/
+template<class Key, class Value, class Compare>
+void BTreeMap<Key, Value, Compare>::remove(const Key& key)
+{
+    if (root_ == nullptr) {
+        return;
+    }
+    Node* node = root_;
+    while (!node->leaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        int i = upperIndex(inner, key);
+        if (inner->children[i]->count <= minCount) {
+            i = fixChild(inner, i);
+        }
+        node = inner->children[i];
+        if (inner == root_ && inner->count == 0) {
+            // the root's last two children merged
+            root_ = node;
+            destroyInner(inner);
+        }
+    }
+    Leaf* leaf = static_cast<Leaf*>(node);
+    int pos = lowerIndex(leaf, key);
+    if (pos == leaf->count || comp_(key, leaf->key(pos))) {
+        return;
+    }
+    leafErase(leaf, pos);
+    size_--;
+    if (leaf->count == 0) {
+        // only the root may run empty
+        destroyLeaf(leaf);
+        root_ = nullptr;
+        first_ = last_ = nullptr;
+    }
+}
+
+/**
+* Empties the tree. When nothing stored needs destroying, the pools hand
+* back their memory without visiting the nodes.
+*/
+template<class Key, class Value, class Compare>
+void BTreeMap<Key, Value, Compare>::clear()
+{
+    if (!NodePool::bulkRelease ||
+        !std::is_trivially_destructible<Key>::value ||
+        !std::is_trivially_destructible<Value>::value) {
+        destroySubtree(root_);
+    }
+    leafPool_.release();
+    innerPool_.release();
+    root_ = nullptr;
+    first_ = last_ = nullptr;
+    size_ = 0;
+}
+
+template<class Key, class Value, class Compare>
+bool BTreeMap<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t BTreeMap<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value, class Compare>
+Compare BTreeMap<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::iterator
+BTreeMap<Key, Value, Compare>::begin()
+{
+    return iterator(first_, 0, this);
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::const_iterator
+BTreeMap<Key, Value, Compare>::begin() const
+{
+    return const_iterator(first_, 0, this);
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::iterator
+BTreeMap<Key, Value, Compare>::end()
+{
+    return iterator(nullptr, 0, this);
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::const_iterator
+BTreeMap<Key, Value, Compare>::end() const
+{
+    return const_iterator(nullptr, 0, this);
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::const_iterator
+BTreeMap<Key, Value, Compare>::cbegin() const
+{
+    return begin();
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::const_iterator
+BTreeMap<Key, Value, Compare>::cend() const
+{
+    return end();
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::iterator
+BTreeMap<Key, Value, Compare>::find(const Key& key)
+{
+    Leaf* leaf = findLeaf(key);
+    if (leaf != nullptr) {
+        int pos = lowerIndex(leaf, key);
+        if (pos < leaf->count && !comp_(key, leaf->key(pos))) {
+            return iterator(leaf, pos, this);
+        }
+    }
+    return end();
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::const_iterator
+BTreeMap<Key, Value, Compare>::find(const Key& key) const
+{
+    Leaf* leaf = findLeaf(key);
+    if (leaf != nullptr) {
+        int pos = lowerIndex(leaf, key);
+        if (pos < leaf->count && !comp_(key, leaf->key(pos))) {
+            return const_iterator(leaf, pos, this);
+        }
+    }
+    return end();
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::iterator
+BTreeMap<Key, Value, Compare>::lower_bound(const Key& key)
+{
+    int index;
+    Leaf* leaf = boundLeaf(key, false, index);
+    return iterator(leaf, index, this);
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::const_iterator
+BTreeMap<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    int index;
+    Leaf* leaf = boundLeaf(key, false, index);
+    return const_iterator(leaf, index, this);
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::iterator
+BTreeMap<Key, Value, Compare>::upper_bound(const Key& key)
+{
+    int index;
+    Leaf* leaf = boundLeaf(key, true, index);
+    return iterator(leaf, index, this);
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::const_iterator
+BTreeMap<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    int index;
+    Leaf* leaf = boundLeaf(key, true, index);
+    return const_iterator(leaf, index, this);
+}
+
+template<class Key, class Value, class Compare>
+Value& BTreeMap<Key, Value, Compare>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<class Key, class Value, class Compare>
+Value const & BTreeMap<Key, Value, Compare>::operator[](const Key& key) const
+{
+    const_iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* The number of keys in node less than key. Comparing arithmetic keys is
+* cheap enough that counting across the whole node without branches
+* beats a binary search's mispredictions.
+*/
+template<class Key, class Value, class Compare>
+int BTreeMap<Key, Value, Compare>::lowerIndex(const Node* node, const Key& key) const
+{
+    if (std::is_arithmetic<Key>::value) {
+        int less = 0;
+        for (int i = 0; i < node->count; ++i) {
+            less += comp_(node->key(i), key);
+        }
+        return less;
+    }
+    int lo = 0;
+    int hi = node->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (comp_(node->key(mid), key)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+* The number of keys in node not greater than key, which is also the
+* child of an inner node to follow for key.
+*/
+template<class Key, class Value, class Compare>
+int BTreeMap<Key, Value, Compare>::upperIndex(const Node* node, const Key& key) const
+{
+    if (std::is_arithmetic<Key>::value) {
+        int notGreater = 0;
+        for (int i = 0; i < node->count; ++i) {
+            notGreater += !comp_(key, node->key(i));
+        }
+        return notGreater;
+    }
+    int lo = 0;
+    int hi = node->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (comp_(key, node->key(mid))) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/**
+* The leaf where key is or would go, or NULL for an empty tree.
+*/
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::Leaf*
+BTreeMap<Key, Value, Compare>::findLeaf(const Key& key) const
+{
+    Node* node = root_;
+    if (node == nullptr) {
+        return nullptr;
+    }
+    while (!node->leaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        node = inner->children[upperIndex(inner, key)];
+    }
+    return static_cast<Leaf*>(node);
+}
+
+/**
+* Finds the first item not less than key (greater than key if upper).
+* Returns its leaf and sets index, or returns NULL for end().
+*/
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::Leaf*
+BTreeMap<Key, Value, Compare>::boundLeaf(const Key& key, bool upper, int& index) const
+{
+    index = 0;
+    Leaf* leaf = findLeaf(key);
+    if (leaf == nullptr) {
+        return nullptr;
+    }
+    index = upper ? upperIndex(leaf, key) : lowerIndex(leaf, key);
+    if (index == leaf->count) {
+        // every key in the following leaves is greater
+        index = 0;
+        return leaf->next;
+    }
+    return leaf;
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::Leaf*
+BTreeMap<Key, Value, Compare>::createLeaf()
+{
+    return new (leafPool_.allocate()) Leaf();
+}
+
+template<class Key, class Value, class Compare>
+typename BTreeMap<Key, Value, Compare>::Inner*
+BTreeMap<Key, Value, Compare>::createInner()
+{
+    return new (innerPool_.allocate()) Inner();
+}
+
+/**
+* Destroys whatever the leaf still holds and hands back its memory.
+*/
+template<class Key, class Value, class Compare>
+void BTreeMap<Key, Value, Compare>::destroyLeaf(Leaf* leaf)
+{
+    for (int i = 0; i < leaf->count; ++i) {
+        leaf->key(i).~Key();
+        leaf->item(i).~pair();
+    }
+    leaf->~Leaf();
+    leafPool_.deallocate(leaf);
+}
+
+template<class Key, class Value, class Compare>
+void BTreeMap<Key, Value, Compare>::destroyInner(Inner* inner)
+{
+    for (int i = 0; i < inner->count; ++i) {
+        inner->key(i).~Key();
+    }
+    inner->~Inner();
+    innerPool_.deallocate(inner);
+}
+
+/**
+* Destroys node and everything below it. The tree is never deeper than a
+* handful of levels, so recursing is safe.
+*/
+template<class Key, class Value, class Compare>
+void BTreeMap<Key, Value, Compare>::destroySubtree(Node* node)
+{
+    if (node == nullptr) {
+        return;
+    }
+    if (node->leaf) {
+        destroyLeaf(static_cast<Leaf*>(node));
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (int i = 0; i <= inner->count; ++i) {
+        destroySubtree(inner->children[i]);
+    }
+    destroyInner(inner);
+}
+
+/**
+* Builds item (copied or moved) at pos, moving the items from pos on one
+* slot up. The leaf must have room.
+*/
+template<class Key, class Value, class Compare>
+template<typename Item>
+void BTreeMap<Key, Value, Compare>::leafInsert(Leaf* leaf, int pos, Item&& item)
+{
+    for (int i = leaf->count; i > pos; --i) {
+        new (&leaf->key(i)) Key(std::move(leaf->key(i - 1)));
+        leaf->key(i - 1).~Key();
+        new (&leaf->item(i)) std::pair<const Key, Value>(std::move(leaf->item(i - 1)));
+        leaf->item(i - 1).~pair();
+    }
+    new (&leaf->key(pos)) Key(item.first);
+    new (&leaf->item(pos)) std::pair<const Key, Value>(std::forward<Item>(item));
+    leaf->count++;
+}
+
+/**
+* Destroys the item at pos and closes the gap.
+*/
+template<class Key, class Value, class Compare>
+void BTreeMap<Key, Value, Compare>::leafErase(Leaf* leaf, int pos)
+{
+    leaf->key(pos).~Key();
+    leaf->item(pos).~pair();
+    for (int i = pos + 1; i < leaf->count; ++i) {
+        new (&leaf->key(i - 1)) Key(std::move(leaf->key(i)));
+        leaf->key(i).~Key();
+        new (&leaf->item(i - 1)) std::pair<const Key, Value>(std::move(leaf->item(i)));
+        leaf->item(i).~pair();
+    }
+    leaf->count--;
+}
+
+/**
+* Puts key in at pos with right as the child just after it. The node
+* must have room.
+*/
+template<class Key, class Value, class Compare>
+void BTreeMap<Key, Value, Compare>::innerInsert(Inner* inner, int pos, const Key& key, Node* right)
+{
+    for (int i = inner->count; i > pos; --i) {
+        new (&inner->key(i)) Key(std::move(inner->key(i - 1)));
+        inner->key(i - 1).~Key();
+        inner->children[i + 1] = inner->children[i];
+    }
+    new (&inner->key(pos)) Key(key);
+    inner->children[pos + 1] = right;
+    inner->count++;
+}
+
+/**
+* Takes out the key at pos and the child just after it.
+*/
+template<class Key, class Value, class Compare>
+void BTreeMap<Key, Value, Compare>::innerErase(Inner* inner, int pos)
+{
+    inner->key(pos).~Key();
+    for (int i = pos + 1; i < inner->count; ++i) {
+        new (&inner->key(i - 1)) Key(std::move(inner->key(i)));
+        inner->key(i).~Key();
+        inner->children[i] = inner->children[i + 1];
+    }
+    inner->count--;
+}
+
+/**
+* Splits the full child i of parent in two and puts the key between the
+* halves into parent, which must have room.
+*/
+template<class Key, class Value, class Compare>
+void BTreeMap<Key, Value, Compare>::splitChild(Inner* parent, int i)
+{
+    Node* child = parent->children[i];
+    int half = child->count / 2;
+    if (child->leaf) {
+        Leaf* leaf = static_cast<Leaf*>(child);
+        Leaf* right = createLeaf();
+        for (int j = half; j < leaf->count; ++j) {
+            leafInsert(right, right->count, std::move(leaf->item(j)));
+        }
+        while (leaf->count > half) {
+            leafErase(leaf, leaf->count - 1);
+        }
+        right->prev = leaf;
+        right->next = leaf->next;
+        if (leaf->next != nullptr) {
+            leaf->next->prev = right;
+        }
+        else {
+            last_ = right;
+        }
+        leaf->next = right;
+        innerInsert(parent, i, right->key(0), right);
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(child);
+    Inner* right = createInner();
+    right->children[0] = inner->children[half + 1];
+    for (int j = half + 1; j < inner->count; ++j) {
+        innerInsert(right, right->count, inner->key(j), inner->children[j + 1]);
+    }
+    innerInsert(parent, i, inner->key(half), right);
+    while (inner->count > half) {
+        inner->key(inner->count - 1).~Key();
+        inner->count--;
+    }
+}
+
+/**
+* Gives child i of parent a key to spare, taking one from a sibling that
+* has more than the minimum or else merging it with a sibling. Returns
+* the index of the child that now covers what child i did.
+*/
+template<class Key, class Value, class Compare>
+int BTreeMap<Key, Value, Compare>::fixChild(Inner* parent, int i)
+{
+    Node* child = parent->children[i];
+    Node* left = i > 0 ? parent->children[i - 1] : nullptr;
+    Node* right = i < parent->count ? parent->children[i + 1] : nullptr;
+    if (left != nullptr && left->count > minCount) {
+        if (child->leaf) {
+            Leaf* from = static_cast<Leaf*>(left);
+            Leaf* to = static_cast<Leaf*>(child);
+            leafInsert(to, 0, std::move(from->item(from->count - 1)));
+            leafErase(from, from->count - 1);
+            parent->key(i - 1) = to->key(0);
+        }
+        else {
+            Inner* from = static_cast<Inner*>(left);
+            Inner* to = static_cast<Inner*>(child);
+            innerInsert(to, 0, parent->key(i - 1), to->children[0]);
+            to->children[0] = from->children[from->count];
+            parent->key(i - 1) = from->key(from->count - 1);
+            from->key(from->count - 1).~Key();
+            from->count--;
+        }
+        return i;
+    }
+    if (right != nullptr && right->count > minCount) {
+        if (child->leaf) {
+            Leaf* from = static_cast<Leaf*>(right);
+            Leaf* to = static_cast<Leaf*>(child);
+            leafInsert(to, to->count, std::move(from->item(0)));
+            leafErase(from, 0);
+            parent->key(i) = from->key(0);
+        }
+        else {
+            Inner* from = static_cast<Inner*>(right);
+            Inner* to = static_cast<Inner*>(child);
+            innerInsert(to, to->count, parent->key(i), from->children[0]);
+            parent->key(i) = from->key(0);
+            // innerErase drops the child after the key, so shift it first
+            from->children[0] = from->children[1];
+            innerErase(from, 0);
+        }
+        return i;
+    }
+    if (left != nullptr) {
+        mergeChildren(parent, i - 1);
+        return i - 1;
+    }
+    mergeChildren(parent, i);
+    return i;
+}
+
+/**
+* Moves everything in child i + 1 of parent (and, for inner nodes, the
+* key between them) into child i and drops child i + 1.
+*/
+template<class Key, class Value, class Compare>
+void BTreeMap<Key, Value, Compare>::mergeChildren(Inner* parent, int i)
+{
+    Node* left = parent->children[i];
+    Node* right = parent->children[i + 1];
+    if (left->leaf) {
+        Leaf* to = static_cast<Leaf*>(left);
+        Leaf* from = static_cast<Leaf*>(right);
+        for (int j = 0; j < from->count; ++j) {
+            leafInsert(to, to->count, std::move(from->item(j)));
+        }
+        to->next = from->next;
+        if (from->next != nullptr) {
+            from->next->prev = to;
+        }
+        else {
+            last_ = to;
+        }
+        destroyLeaf(from);
+    }
+    else {
+        Inner* to = static_cast<Inner*>(left);
+        Inner* from = static_cast<Inner*>(right);
+        innerInsert(to, to->count, parent->key(i), from->children[0]);
+        for (int j = 0; j < from->count; ++j) {
+            innerInsert(to, to->count, from->key(j), from->children[j + 1]);
+        }
+        destroyInner(from);
+    }
+    innerErase(parent, i);
+}
+
+/*
+-----------------------------------------
+End implementations for the BTreeMap class.
+-----------------------------------------
+*/
+
+#endif
@@ -0,0 +1,485 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+* A file of fixed-size pages, read through a cache of at most a set
+* number of them. Pages are pinned while in use; once no longer pinned a
+* page stays cached until it is the least recently used one and its
+* frame is needed for another page. Changed pages are written back when
+* they are evicted or on flush(), not before.
+*
+* Not safe to use from several threads at once.
+*/
+class BufferPool
+{
+public:
+    /**
+    * Counts since the pool was opened or last reset: pins served from
+    * the cache and pins that had to load their page, pages read from and
+    * written to the file, and pages pushed out to make room.
+    */
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t reads;
+        uint64_t writes;
+        uint64_t evictions;
+    };
+
+    /**
+    * A pinned page. The page stays in memory, at data(), until the handle
+    * is released or destroyed.
+    */
+    class Page
+    {
+    public:
+        Page();
+        Page(Page&& other);
+        Page& operator=(Page&& other);
+        ~Page();
+
+        char* data() const;
+        uint64_t id() const;
+        void markDirty();
+        void release();
+
+    private:
+        friend class BufferPool;
+        Page(BufferPool* pool, int frame);
+        Page(const Page&);
+        Page& operator=(const Page&);
+
+        BufferPool* pool_;
+        int frame_;
+    };
+
+    BufferPool(const std::string& path, std::size_t pageSize, std::size_t cacheBytes);
+    ~BufferPool();
+
+    Page pin(uint64_t id);
+    Page allocate();
+    void truncate(uint64_t pageCount);
+    void flush();
+
+    std::size_t pageSize() const;
+    std::size_t frameCount() const;
+    uint64_t pageCount() const;
+    Stats stats() const;
+    void resetStats();
+
+private:
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+
+    struct Frame
+    {
+        uint64_t page;
+        int pins;
+        bool dirty;
+        // neighbours in the recently used list, most recent first
+        int prev;
+        int next;
+    };
+
+    // pinning a page for an operation never needs more frames than this
+    static const std::size_t minFrames = 8;
+
+    char* frameData(int frame) const;
+    int takeFrame();
+    void unlink(int frame);
+    void pushFront(int frame);
+    void readPage(int frame);
+    void writePage(int frame);
+
+    int fd_;
+    std::size_t pageSize_;
+    uint64_t pageCount_;
+    char* memory_;
+    std::vector<Frame> frames_;
+    std::vector<int> freeFrames_;
+    std::unordered_map<uint64_t, int> table_;
+    int head_;
+    int tail_;
+    Stats stats_;
+};
+
+/*
+-----------------------------------------------------
+Begin implementations for the BufferPool::Page class.
+-----------------------------------------------------
+*/
+
+inline BufferPool::Page::Page() :
+    pool_(nullptr),
+    frame_(-1)
+{
+
+}
+
+inline BufferPool::Page::Page(BufferPool* pool, int frame) :
+    pool_(pool),
+    frame_(frame)
+{
+
+}
+
+inline BufferPool::Page::Page(Page&& other) :
+    pool_(other.pool_),
+    frame_(other.frame_)
+{
+    other.pool_ = nullptr;
+    other.frame_ = -1;
+}
+
+inline BufferPool::Page& BufferPool::Page::operator=(Page&& other)
+{
+    if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        frame_ = other.frame_;
+        other.pool_ = nullptr;
+        other.frame_ = -1;
+    }
+    return *this;
+}
+
+inline BufferPool::Page::~Page()
+{
+    release();
+}
+
+inline char* BufferPool::Page::data() const
+{
+    return pool_->frameData(frame_);
+}
+
+inline uint64_t BufferPool::Page::id() const
+{
+    return pool_->frames_[frame_].page;
+}
+
+/**
+* Marks the page as changed, so that it is written back before its frame
+* is reused.
+*/
+inline void BufferPool::Page::markDirty()
+{
+    pool_->frames_[frame_].dirty = true;
+}
+
+/**
+* Unpins the page early; the handle is empty afterwards.
+*/
+inline void BufferPool::Page::release()
+{
+    if (pool_ != nullptr) {
+        pool_->frames_[frame_].pins--;
+        pool_ = nullptr;
+        frame_ = -1;
+    }
+}
+
+/*
+---------------------------------------------------
+End implementations for the BufferPool::Page class.
+---------------------------------------------------
+*/
+
+/*
+-----------------------------------------------
+Begin implementations for the BufferPool class.
+-----------------------------------------------
+*/
+
+/**
+* Opens path, creating it if need be, with a cache of cacheBytes worth
+* of pages (but never fewer than minFrames). Throws std::runtime_error if
+* the file cannot be opened.
+*/
+inline BufferPool::BufferPool(const std::string& path, std::size_t pageSize, std::size_t cacheBytes) :
+    fd_(-1),
+    pageSize_(pageSize),
+    pageCount_(0),
+    memory_(nullptr),
+    head_(-1),
+    tail_(-1)
+{
+    std::memset(&stats_, 0, sizeof(stats_));
+    std::size_t count = cacheBytes / pageSize;
+    if (count < minFrames) {
+        count = minFrames;
+    }
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("buffer pool: cannot open " + path);
+    }
+    struct stat info;
+    void* memory = nullptr;
+    if (::fstat(fd_, &info) != 0 || ::posix_memalign(&memory, pageSize, count * pageSize) != 0) {
+        ::close(fd_);
+        throw std::runtime_error("buffer pool: cannot set up " + path);
+    }
+    memory_ = static_cast<char*>(memory);
+    pageCount_ = (static_cast<uint64_t>(info.st_size) + pageSize - 1) / pageSize;
+    Frame unused = { 0, 0, false, -1, -1 };
+    frames_.assign(count, unused);
+    freeFrames_.reserve(count);
+    for (std::size_t i = count; i > 0; --i) {
+        freeFrames_.push_back(static_cast<int>(i - 1));
+    }
+    table_.reserve(count);
+}
+
+/**
+* Writes back whatever is dirty. Errors cannot be reported from here; call
+* flush() first to see them.
+*/
+inline BufferPool::~BufferPool()
+{
+    try {
+        flush();
+    }
+    catch (const std::runtime_error&) {
+    }
+    std::free(memory_);
+    ::close(fd_);
+}
+
+/**
+* Pins page id, reading it in if it is not cached. Throws
+* std::runtime_error if every frame is pinned or the read fails.
+*/
+inline BufferPool::Page BufferPool::pin(uint64_t id)
+{
+    std::unordered_map<uint64_t, int>::const_iterator found = table_.find(id);
+    int frame;
+    if (found != table_.end()) {
+        stats_.hits++;
+        frame = found->second;
+        unlink(frame);
+    }
+    else {
+        stats_.misses++;
+        frame = takeFrame();
+        frames_[frame].page = id;
+        frames_[frame].dirty = false;
+        try {
+            readPage(frame);
+        }
+        catch (const std::runtime_error&) {
+            freeFrames_.push_back(frame);
+            throw;
+        }
+        table_[id] = frame;
+    }
+    frames_[frame].pins++;
+    pushFront(frame);
+    return Page(this, frame);
+}
+
+/**
+* Adds a zeroed page at the end of the file and pins it.
+*/
+inline BufferPool::Page BufferPool::allocate()
+{
+    int frame = takeFrame();
+    frames_[frame].page = pageCount_++;
+    frames_[frame].dirty = true;
+    frames_[frame].pins = 1;
+    std::memset(frameData(frame), 0, pageSize_);
+    table_[frames_[frame].page] = frame;
+    pushFront(frame);
+    return Page(this, frame);
+}
+
+/**
+* Drops every page from pageCount on, cached or not. None of them may be
+* pinned.
+*/
+inline void BufferPool::truncate(uint64_t pageCount)
+{
+    for (std::size_t frame = 0; frame < frames_.size(); ++frame) {
+        std::unordered_map<uint64_t, int>::iterator it = table_.find(frames_[frame].page);
+        if (it != table_.end() && it->second == static_cast<int>(frame) && frames_[frame].page >= pageCount) {
+            table_.erase(it);
+            unlink(static_cast<int>(frame));
+            freeFrames_.push_back(static_cast<int>(frame));
+        }
+    }
+    if (::ftruncate(fd_, static_cast<off_t>(pageCount * pageSize_)) != 0) {
+        throw std::runtime_error("buffer pool: cannot truncate");
+    }
+    pageCount_ = pageCount;
+}
+
+/**
+* Writes back every dirty page and asks the system to put the file on
+* disk.
+*/
+inline void BufferPool::flush()
+{
+    for (std::unordered_map<uint64_t, int>::const_iterator it = table_.begin(); it != table_.end(); ++it) {
+        if (frames_[it->second].dirty) {
+            writePage(it->second);
+        }
+    }
+    if (::fsync(fd_) != 0) {
+        throw std::runtime_error("buffer pool: cannot sync");
+    }
+}
+
+inline std::size_t BufferPool::pageSize() const
+{
+    return pageSize_;
+}
+
+inline std::size_t BufferPool::frameCount() const
+{
+    return frames_.size();
+}
+
+inline uint64_t BufferPool::pageCount() const
+{
+    return pageCount_;
+}
+
+inline BufferPool::Stats BufferPool::stats() const
+{
+    return stats_;
+}
+
+inline void BufferPool::resetStats()
+{
+    std::memset(&stats_, 0, sizeof(stats_));
+}
+
+inline char* BufferPool::frameData(int frame) const
+{
+    return memory_ + static_cast<std::size_t>(frame) * pageSize_;
+}
+
+/**
+* A frame to load a page into: a free one if there is one, otherwise the
+* least recently used unpinned one, written back first if dirty.
+*/
+inline int BufferPool::takeFrame()
+{
+    if (!freeFrames_.empty()) {
+        int frame = freeFrames_.back();
+        freeFrames_.pop_back();
+        return frame;
+    }
+    int frame = tail_;
+    while (frame != -1 && frames_[frame].pins > 0) {
+        frame = frames_[frame].prev;
+    }
+    if (frame == -1) {
+        throw std::runtime_error("buffer pool: every page is pinned");
+    }
+    if (frames_[frame].dirty) {
+        writePage(frame);
+    }
+    stats_.evictions++;
+    table_.erase(frames_[frame].page);
+    unlink(frame);
+    return frame;
+}
+
+inline void BufferPool::unlink(int frame)
+{
+    Frame& f = frames_[frame];
+    if (f.prev != -1) {
+        frames_[f.prev].next = f.next;
+    }
+    else {
+        head_ = f.next;
+    }
+    if (f.next != -1) {
+        frames_[f.next].prev = f.prev;
+    }
+    else {
+        tail_ = f.prev;
+    }
+    f.prev = f.next = -1;
+}
+
+inline void BufferPool::pushFront(int frame)
+{
+    frames_[frame].prev = -1;
+    frames_[frame].next = head_;
+    if (head_ != -1) {
+        frames_[head_].prev = frame;
+    }
+    else {
+        tail_ = frame;
+    }
+    head_ = frame;
+}
+
+/**
+* Reads the frame's page from the file. Whatever lies past the end of
+* the file, or in a hole in it, reads as zeros.
+*/
+inline void BufferPool::readPage(int frame)
+{
+    char* data = frameData(frame);
+    off_t offset = static_cast<off_t>(frames_[frame].page * pageSize_);
+    std::size_t done = 0;
+    while (done < pageSize_) {
+        ssize_t got = ::pread(fd_, data + done, pageSize_ - done, offset + done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            throw std::runtime_error("buffer pool: read failed");
+        }
+        if (got == 0) {
+            std::memset(data + done, 0, pageSize_ - done);
+            break;
+        }
+        done += static_cast<std::size_t>(got);
+    }
+    stats_.reads++;
+}
+
+inline void BufferPool::writePage(int frame)
+{
+    const char* data = frameData(frame);
+    off_t offset = static_cast<off_t>(frames_[frame].page * pageSize_);
+    std::size_t done = 0;
+    while (done < pageSize_) {
+        ssize_t put = ::pwrite(fd_, data + done, pageSize_ - done, offset + done);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            throw std::runtime_error("buffer pool: write failed");
+        }
+        done += static_cast<std::size_t>(put);
+    }
+    frames_[frame].dirty = false;
+    stats_.writes++;
+}
+
+/*
+---------------------------------------------
+End implementations for the BufferPool class.
+---------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,1091 @@
+#ifndef COMPACTBST_H
+#define COMPACTBST_H
+
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include <utility>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <new>
+
+/**
+* A node for a CompactAVLTree. The links are 32-bit indices into the
+* tree's node array instead of pointers, so a CompactNode<int,int> is
+* 24 bytes rather than the 40 of an AVLNode<int,int>.
+*/
+template <typename Key, typename Value>
+struct CompactNode
+{
+    CompactNode(const Key& key, const Value& value, uint32_t parent);
+
+    std::pair<const Key, Value> item;
+    uint32_t parent;
+    uint32_t left;
+    uint32_t right;
+    int8_t balance;     // right height minus left height, as in AVLNode
+};
+
+/**
+* Value used for a missing parent/left/right link.
+*/
+static const uint32_t COMPACT_NIL = 0xffffffffu;
+
+template<typename Key, typename Value>
+CompactNode<Key, Value>::CompactNode(const Key& key, const Value& value, uint32_t parent) :
+    item(key, value),
+    parent(parent),
+    left(COMPACT_NIL),
+    right(COMPACT_NIL),
+    balance(0)
+{
+
+}
+
+/**
+* An AVL tree whose nodes live in one contiguous, growable array and link
+* to each other by index. Lookups and scans touch far fewer cache lines
+* than the pointer-based trees.
+*
+* It covers the core of AVLTree's interface: insert() of a pair, remove(),
+* clear(), size(), empty(), find() (transparent too), operator[],
+* lower_bound()/upper_bound() and bidirectional iterators, const and
+* reverse ones included. It has none of the emplace/hinted inserts,
+* erase(iterator), split/join, set operations or batches.
+*
+* Removing a key moves the last node in the array into the freed slot to
+* keep the array dense, so a remove invalidates iterators to that node.
+* Inserts never invalidate iterators.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class CompactAVLTree
+{
+public:
+    CompactAVLTree();
+    explicit CompactAVLTree(const Compare& comp);
+    ~CompactAVLTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    void reserve(std::size_t count);
+    bool isBalanced() const;
+    bool empty() const;
+    std::size_t size() const;
+
+    class const_iterator;
+
+    /**
+    * A bidirectional iterator over the contents of the tree in key order;
+    * decrementing end() lands on the largest item.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class CompactAVLTree<Key, Value, Compare>;
+        friend class const_iterator;
+        iterator(CompactAVLTree<Key, Value, Compare>* tree, uint32_t index);
+        CompactAVLTree<Key, Value, Compare>* tree_;
+        uint32_t current_;
+    };
+
+    /**
+    * A read-only iterator, handed out by const trees. Any iterator
+    * converts to one.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class CompactAVLTree<Key, Value, Compare>;
+        const_iterator(const CompactAVLTree<Key, Value, Compare>* tree, uint32_t index);
+        const CompactAVLTree<Key, Value, Compare>* tree_;
+        uint32_t current_;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    iterator begin();
+    const_iterator begin() const;
+    iterator end();
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin();
+    const_reverse_iterator rbegin() const;
+    reverse_iterator rend();
+    const_reverse_iterator rend() const;
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator find(const K& key) const;
+    iterator lower_bound(const Key& key);
+    const_iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key);
+    const_iterator upper_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    uint32_t internalFind(const Key& key) const;
+    template<typename K>
+    uint32_t lookup(const K& key) const;
+    uint32_t lowerBoundSlot(const Key& key) const;
+    uint32_t upperBoundSlot(const Key& key) const;
+    uint32_t getSmallestNode() const;
+    uint32_t getLargestNode() const;
+    uint32_t successor(uint32_t node) const;
+    uint32_t predecessor(uint32_t node) const;
+    uint32_t addNode(const std::pair<const Key, Value>& keyValuePair, uint32_t parent);
+    void eraseSlot(uint32_t node);
+    void replaceChild(uint32_t parent, uint32_t oldChild, uint32_t newChild);
+    void insertFix(uint32_t parent, uint32_t child);
+    void removeFix(uint32_t node, int8_t diff);
+    uint32_t balance(uint32_t node);
+    uint32_t rotateLeft(uint32_t node);
+    uint32_t rotateRight(uint32_t node);
+    int checkHeight(uint32_t node) const;
+
+    std::vector<CompactNode<Key, Value> > nodes_;
+    uint32_t root_;
+    Compare comp_;
+};
+
+/*
+--------------------------------------------------------------
+Begin implementations for the CompactAVLTree::iterator class.
+--------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::iterator::iterator(CompactAVLTree<Key, Value, Compare>* tree, uint32_t index) :
+    tree_(tree),
+    current_(index)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::iterator::iterator() : tree_(nullptr), current_(COMPACT_NIL)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value> &
+CompactAVLTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return tree_->nodes_[current_].item;
+}
+
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value> *
+CompactAVLTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &(tree_->nodes_[current_].item);
+}
+
+/**
+* Iterators are equal when they point at the same slot; all end
+* iterators compare equal.
+*/
+template<class Key, class Value, class Compare>
+bool
+CompactAVLTree<Key, Value, Compare>::iterator::operator==(
+    const CompactAVLTree<Key, Value, Compare>::iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<class Key, class Value, class Compare>
+bool
+CompactAVLTree<Key, Value, Compare>::iterator::operator!=(
+    const CompactAVLTree<Key, Value, Compare>::iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator&
+CompactAVLTree<Key, Value, Compare>::iterator::operator++()
+{
+    current_ = tree_->successor(current_);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves the iterator back one item; from end() that is the largest one.
+*/
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator&
+CompactAVLTree<Key, Value, Compare>::iterator::operator--()
+{
+    if (current_ == COMPACT_NIL) {
+        current_ = tree_->getLargestNode();
+    } else {
+        current_ = tree_->predecessor(current_);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+------------------------------------------------------------
+End implementations for the CompactAVLTree::iterator class.
+------------------------------------------------------------
+*/
+
+/*
+------------------------------------------------------------------
+Begin implementations for the CompactAVLTree::const_iterator class.
+------------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::const_iterator::const_iterator(const CompactAVLTree<Key, Value, Compare>* tree, uint32_t index) :
+    tree_(tree),
+    current_(index)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::const_iterator::const_iterator() : tree_(nullptr), current_(COMPACT_NIL)
+{
+
+}
+
+/**
+* Lets a mutable iterator be used wherever a read-only one is expected.
+*/
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::const_iterator::const_iterator(const iterator& it) :
+    tree_(it.tree_),
+    current_(it.current_)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value> &
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return tree_->nodes_[current_].item;
+}
+
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value> *
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &(tree_->nodes_[current_].item);
+}
+
+template<class Key, class Value, class Compare>
+bool
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator==(
+    const CompactAVLTree<Key, Value, Compare>::const_iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<class Key, class Value, class Compare>
+bool
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator!=(
+    const CompactAVLTree<Key, Value, Compare>::const_iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator&
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    current_ = tree_->successor(current_);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator&
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    if (current_ == COMPACT_NIL) {
+        current_ = tree_->getLargestNode();
+    } else {
+        current_ = tree_->predecessor(current_);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+----------------------------------------------------------------
+End implementations for the CompactAVLTree::const_iterator class.
+----------------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------
+Begin implementations for the CompactAVLTree class.
+-----------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree() : root_(COMPACT_NIL), comp_()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree(const Compare& comp) : root_(COMPACT_NIL), comp_(comp)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::~CompactAVLTree()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+bool CompactAVLTree<Key, Value, Compare>::empty() const
+{
+    return root_ == COMPACT_NIL;
+}
+
+/**
+* The array is kept dense, so its length is the number of keys.
+*/
+template<class Key, class Value, class Compare>
+std::size_t CompactAVLTree<Key, Value, Compare>::size() const
+{
+    return nodes_.size();
+}
+
+/**
+* Empties the tree and gives the node array back to the heap.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::clear()
+{
+    std::vector<CompactNode<Key, Value> >().swap(nodes_);
+    root_ = COMPACT_NIL;
+}
+
+/**
+* Preallocates room for count nodes so that filling the tree
+* does not regrow the array.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::reserve(std::size_t count)
+{
+    nodes_.reserve(count);
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::begin()
+{
+    return iterator(this, getSmallestNode());
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(this, getSmallestNode());
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::end()
+{
+    return iterator(this, COMPACT_NIL);
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(this, COMPACT_NIL);
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::cbegin() const
+{
+    return begin();
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::cend() const
+{
+    return end();
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::reverse_iterator
+CompactAVLTree<Key, Value, Compare>::rbegin()
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_reverse_iterator
+CompactAVLTree<Key, Value, Compare>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::reverse_iterator
+CompactAVLTree<Key, Value, Compare>::rend()
+{
+    return reverse_iterator(begin());
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_reverse_iterator
+CompactAVLTree<Key, Value, Compare>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::find(const Key& key)
+{
+    return iterator(this, internalFind(key));
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return const_iterator(this, internalFind(key));
+}
+
+/**
+* Heterogeneous find(), for transparent comparators such as std::less<>.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::find(const K& key)
+{
+    return iterator(this, lookup(key));
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::find(const K& key) const
+{
+    return const_iterator(this, lookup(key));
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or the end iterator if there is none.
+*/
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::lower_bound(const Key& key)
+{
+    return iterator(this, lowerBoundSlot(key));
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return const_iterator(this, lowerBoundSlot(key));
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or the end iterator if there is none.
+*/
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::upper_bound(const Key& key)
+{
+    return iterator(this, upperBoundSlot(key));
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::const_iterator
+CompactAVLTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return const_iterator(this, upperBoundSlot(key));
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+Value& CompactAVLTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    uint32_t curr = internalFind(key);
+    if(curr == COMPACT_NIL) throw std::out_of_range("Invalid key");
+    return nodes_[curr].item.second;
+}
+template<class Key, class Value, class Compare>
+Value const & CompactAVLTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    uint32_t curr = internalFind(key);
+    if(curr == COMPACT_NIL) throw std::out_of_range("Invalid key");
+    return nodes_[curr].item.second;
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    // one comparison per level, as in BinarySearchTree::insert()
+    uint32_t current = root_;
+    uint32_t parent = COMPACT_NIL;
+    uint32_t candidate = COMPACT_NIL;
+    bool goLeft = false;
+    while (current != COMPACT_NIL) {
+        parent = current;
+        goLeft = comp_(keyValuePair.first, nodes_[current].item.first);
+        if (goLeft) {
+            current = nodes_[current].left;
+        }
+        else {
+            candidate = current;
+            current = nodes_[current].right;
+        }
+    }
+    if (candidate != COMPACT_NIL && !comp_(nodes_[candidate].item.first, keyValuePair.first)) {
+        nodes_[candidate].item.second = keyValuePair.second;
+        return;
+    }
+
+    uint32_t newNode = addNode(keyValuePair, parent);
+    if (parent == COMPACT_NIL) {
+        root_ = newNode;
+        return;
+    }
+    if (goLeft) {
+        nodes_[parent].left = newNode;
+    }
+    else {
+        nodes_[parent].right = newNode;
+    }
+    insertFix(parent, newNode);
+}
+
+/**
+* Removes the key if present. A node with two children is replaced by its
+* predecessor, which keeps that node's position and balance.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    uint32_t node = internalFind(key);
+    if (node == COMPACT_NIL) {
+        return;
+    }
+
+    uint32_t start;
+    int8_t diff;
+    CompactNode<Key, Value>& n = nodes_[node];
+    if (n.left != COMPACT_NIL && n.right != COMPACT_NIL) {
+        uint32_t pred = n.left;
+        while (nodes_[pred].right != COMPACT_NIL) {
+            pred = nodes_[pred].right;
+        }
+        CompactNode<Key, Value>& p = nodes_[pred];
+        if (p.parent == node) {
+            // pred keeps its own left subtree, which is one shorter than
+            // the subtree pred used to head
+            start = pred;
+            diff = 1;
+        }
+        else {
+            start = p.parent;
+            diff = -1;
+            nodes_[p.parent].right = p.left;
+            if (p.left != COMPACT_NIL) {
+                nodes_[p.left].parent = p.parent;
+            }
+            p.left = n.left;
+            nodes_[n.left].parent = pred;
+        }
+        p.right = n.right;
+        nodes_[n.right].parent = pred;
+        p.parent = n.parent;
+        p.balance = n.balance;
+        replaceChild(n.parent, node, pred);
+    }
+    else {
+        uint32_t child = (n.left != COMPACT_NIL) ? n.left : n.right;
+        start = n.parent;
+        diff = 0;
+        if (child != COMPACT_NIL) {
+            nodes_[child].parent = n.parent;
+        }
+        if (start != COMPACT_NIL) {
+            diff = (nodes_[start].left == node) ? 1 : -1;
+        }
+        replaceChild(n.parent, node, child);
+    }
+
+    removeFix(start, diff);
+    eraseSlot(node);
+}
+
+/**
+* Appends a node to the array and returns its index.
+*/
+template<class Key, class Value, class Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::addNode(const std::pair<const Key, Value>& keyValuePair, uint32_t parent)
+{
+    if (nodes_.size() >= COMPACT_NIL) {
+        throw std::length_error("CompactAVLTree is full");
+    }
+    nodes_.push_back(CompactNode<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
+    return static_cast<uint32_t>(nodes_.size() - 1);
+}
+
+/**
+* Frees the slot of an already unlinked node by moving the last node of
+* the array into it and pointing that node's neighbours at its new index.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::eraseSlot(uint32_t node)
+{
+    uint32_t last = static_cast<uint32_t>(nodes_.size() - 1);
+    if (node != last) {
+        nodes_[node].~CompactNode<Key, Value>();
+        CompactNode<Key, Value>& hole =
+            *new (&nodes_[node]) CompactNode<Key, Value>(std::move(nodes_[last]));
+        replaceChild(hole.parent, last, node);
+        if (hole.left != COMPACT_NIL) {
+            nodes_[hole.left].parent = node;
+        }
+        if (hole.right != COMPACT_NIL) {
+            nodes_[hole.right].parent = node;
+        }
+    }
+    nodes_.pop_back();
+}
+
+/**
+* Points whichever link of parent referred to oldChild at newChild,
+* or moves the root when parent is NIL.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::replaceChild(uint32_t parent, uint32_t oldChild, uint32_t newChild)
+{
+    if (parent == COMPACT_NIL) {
+        root_ = newChild;
+    }
+    else if (nodes_[parent].left == oldChild) {
+        nodes_[parent].left = newChild;
+    }
+    else {
+        nodes_[parent].right = newChild;
+    }
+}
+
+/**
+* Same retrace as AVLTree::insertFix(), on indices.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::insertFix(uint32_t parent, uint32_t child)
+{
+    while (parent != COMPACT_NIL) {
+        CompactNode<Key, Value>& p = nodes_[parent];
+        p.balance += (child == p.left) ? -1 : 1;
+        if (p.balance == 0) {
+            return;
+        }
+        if (p.balance == -2 || p.balance == 2) {
+            balance(parent);
+            return;
+        }
+        child = parent;
+        parent = p.parent;
+    }
+}
+
+/**
+* Same retrace as AVLTree::removeFix(), on indices.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::removeFix(uint32_t node, int8_t diff)
+{
+    while (node != COMPACT_NIL) {
+        uint32_t parent = nodes_[node].parent;
+        int8_t nextDiff = 0;
+        if (parent != COMPACT_NIL) {
+            nextDiff = (nodes_[parent].left == node) ? 1 : -1;
+        }
+
+        nodes_[node].balance += diff;
+        int8_t b = nodes_[node].balance;
+        if (b == 1 || b == -1) {
+            return;
+        }
+        if (b != 0) {
+            if (nodes_[balance(node)].balance != 0) {
+                return;
+            }
+        }
+        node = parent;
+        diff = nextDiff;
+    }
+}
+
+template<class Key, class Value, class Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::rotateLeft(uint32_t node)
+{
+    CompactNode<Key, Value>& n = nodes_[node];
+    uint32_t y = n.right;
+    uint32_t t2 = nodes_[y].left;
+
+    nodes_[y].left = node;
+    n.right = t2;
+    if (t2 != COMPACT_NIL) {
+        nodes_[t2].parent = node;
+    }
+    nodes_[y].parent = n.parent;
+    replaceChild(n.parent, node, y);
+    n.parent = y;
+    return y;
+}
+
+template<class Key, class Value, class Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::rotateRight(uint32_t node)
+{
+    CompactNode<Key, Value>& n = nodes_[node];
+    uint32_t y = n.left;
+    uint32_t t2 = nodes_[y].right;
+
+    nodes_[y].right = node;
+    n.left = t2;
+    if (t2 != COMPACT_NIL) {
+        nodes_[t2].parent = node;
+    }
+    nodes_[y].parent = n.parent;
+    replaceChild(n.parent, node, y);
+    n.parent = y;
+    return y;
+}
+
+/**
+* Same single/double rotation rules as AVLTree::balance().
+*/
+template<class Key, class Value, class Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::balance(uint32_t node)
+{
+    CompactNode<Key, Value>& n = nodes_[node];
+    if (n.balance < -1) {
+        uint32_t child = n.left;
+        CompactNode<Key, Value>& c = nodes_[child];
+        if (c.balance <= 0) {
+            uint32_t root = rotateRight(node);
+            if (c.balance == 0) {
+                n.balance = -1;
+                c.balance = 1;
+            }
+            else {
+                n.balance = 0;
+                c.balance = 0;
+            }
+            return root;
+        }
+        uint32_t grand = c.right;
+        int8_t gb = nodes_[grand].balance;
+        rotateLeft(child);
+        rotateRight(node);
+        n.balance = (gb == -1) ? 1 : 0;
+        c.balance = (gb == 1) ? -1 : 0;
+        nodes_[grand].balance = 0;
+        return grand;
+    }
+
+    if (n.balance > 1) {
+        uint32_t child = n.right;
+        CompactNode<Key, Value>& c = nodes_[child];
+        if (c.balance >= 0) {
+            uint32_t root = rotateLeft(node);
+            if (c.balance == 0) {
+                n.balance = 1;
+                c.balance = -1;
+            }
+            else {
+                n.balance = 0;
+                c.balance = 0;
+            }
+            return root;
+        }
+        uint32_t grand = c.left;
+        int8_t gb = nodes_[grand].balance;
+        rotateRight(child);
+        rotateLeft(node);
+        n.balance = (gb == 1) ? -1 : 0;
+        c.balance = (gb == -1) ? 1 : 0;
+        nodes_[grand].balance = 0;
+        return grand;
+    }
+
+    return node;
+}
+
+template<class Key, class Value, class Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::internalFind(const Key& key) const
+{
+    return lookup(key);
+}
+
+/**
+* Single-comparison descent, as in BinarySearchTree::lookup().
+*/
+template<class Key, class Value, class Compare>
+template<typename K>
+uint32_t CompactAVLTree<Key, Value, Compare>::lookup(const K& key) const
+{
+    uint32_t current = root_;
+    uint32_t candidate = COMPACT_NIL;
+    while (current != COMPACT_NIL) {
+        const CompactNode<Key, Value>& node = nodes_[current];
+        if (comp_(key, node.item.first)) {
+            current = node.left;
+        } else {
+            candidate = current;
+            current = node.right;
+        }
+    }
+    if (candidate != COMPACT_NIL && !comp_(nodes_[candidate].item.first, key)) {
+        return candidate;
+    }
+    return COMPACT_NIL;
+}
+
+/**
+* Same descent as BinarySearchTree::lowerBoundNode(), on indices.
+*/
+template<class Key, class Value, class Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::lowerBoundSlot(const Key& key) const
+{
+    uint32_t bound = COMPACT_NIL;
+    uint32_t current = root_;
+    while (current != COMPACT_NIL) {
+        if (comp_(nodes_[current].item.first, key)) {
+            current = nodes_[current].right;
+        } else {
+            bound = current;
+            current = nodes_[current].left;
+        }
+    }
+    return bound;
+}
+
+template<class Key, class Value, class Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::upperBoundSlot(const Key& key) const
+{
+    uint32_t bound = COMPACT_NIL;
+    uint32_t current = root_;
+    while (current != COMPACT_NIL) {
+        if (comp_(key, nodes_[current].item.first)) {
+            bound = current;
+            current = nodes_[current].left;
+        } else {
+            current = nodes_[current].right;
+        }
+    }
+    return bound;
+}
+
+template<class Key, class Value, class Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::getSmallestNode() const
+{
+    uint32_t current = root_;
+    if (current == COMPACT_NIL) {
+        return COMPACT_NIL;
+    }
+    while (nodes_[current].left != COMPACT_NIL) {
+        current = nodes_[current].left;
+    }
+    return current;
+}
+
+template<class Key, class Value, class Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::getLargestNode() const
+{
+    uint32_t current = root_;
+    if (current == COMPACT_NIL) {
+        return COMPACT_NIL;
+    }
+    while (nodes_[current].right != COMPACT_NIL) {
+        current = nodes_[current].right;
+    }
+    return current;
+}
+
+template<class Key, class Value, class Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::successor(uint32_t node) const
+{
+    if (node == COMPACT_NIL) {
+        return COMPACT_NIL;
+    }
+    if (nodes_[node].right != COMPACT_NIL) {
+        node = nodes_[node].right;
+        while (nodes_[node].left != COMPACT_NIL) {
+            node = nodes_[node].left;
+        }
+        return node;
+    }
+    uint32_t parent = nodes_[node].parent;
+    while (parent != COMPACT_NIL && node == nodes_[parent].right) {
+        node = parent;
+        parent = nodes_[parent].parent;
+    }
+    return parent;
+}
+
+template<class Key, class Value, class Compare>
+uint32_t CompactAVLTree<Key, Value, Compare>::predecessor(uint32_t node) const
+{
+    if (node == COMPACT_NIL) {
+        return COMPACT_NIL;
+    }
+    if (nodes_[node].left != COMPACT_NIL) {
+        node = nodes_[node].left;
+        while (nodes_[node].right != COMPACT_NIL) {
+            node = nodes_[node].right;
+        }
+        return node;
+    }
+    uint32_t parent = nodes_[node].parent;
+    while (parent != COMPACT_NIL && node == nodes_[parent].left) {
+        node = parent;
+        parent = nodes_[parent].parent;
+    }
+    return parent;
+}
+
+/**
+ * Return true iff every subtree's heights differ by at most one.
+ */
+template<class Key, class Value, class Compare>
+bool CompactAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkHeight(root_) >= 0;
+}
+
+/**
+* Returns the height of the subtree, or -1 if any part of it is unbalanced.
+*/
+template<class Key, class Value, class Compare>
+int CompactAVLTree<Key, Value, Compare>::checkHeight(uint32_t node) const
+{
+    if (node == COMPACT_NIL) {
+        return 0;
+    }
+    int leftHeight = checkHeight(nodes_[node].left);
+    int rightHeight = checkHeight(nodes_[node].right);
+    if (leftHeight < 0 || rightHeight < 0 || std::abs(leftHeight - rightHeight) > 1) {
+        return -1;
+    }
+    return std::max(leftHeight, rightHeight) + 1;
+}
+
+/*
+---------------------------------------------------
+End implementations for the CompactAVLTree class.
+---------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,978 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "epoch_manager.h"
+
+/**
+ * An AVL tree that many threads can use at once, after Bronson, Casper,
+ * Chafi and Olukotun's optimistic AVL tree.
+ *
+ * Readers take no locks. Every node carries a version that a rotation
+ * bumps when it moves the node down; a reader notes a node's version,
+ * reads the child it wants, and checks the version again, going back up a
+ * level if the node changed in between. Writers lock just the nodes whose
+ * links they change, always parent before child. Heights are fixed up
+ * after the fact, so the tree may be briefly out of balance while
+ * writers are busy.
+ *
+ * Removing a key whose node has two children leaves it in place as a
+ * routing node without a value; routing nodes are unlinked once they are
+ * down to one child. Unlinked nodes and replaced values are freed through
+ * an EpochManager once no reader can still reach them.
+ *
+ * Nodes come from the global heap since NodePool is not thread safe.
+ * Values are copied out by find(), so there are no iterators.
+ */
+template <class Key, class Value, class Compare = std::less<Key> >
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    explicit ConcurrentAVLTree(const Compare& comp);
+    ~ConcurrentAVLTree();
+
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    std::size_t size() const;
+    bool empty() const;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+    struct Node;
+
+    // Writers hold node locks only briefly, so a one-byte spin lock keeps
+    // nodes small where a std::mutex would double their size.
+    class SpinLock
+    {
+    public:
+        SpinLock();
+        void lock();
+        void unlock();
+
+    private:
+        std::atomic<bool> locked_;
+    };
+
+    // Everything but the key, so that the root holder needs no key.
+    struct Link
+    {
+        Link(Value* value, Link* parent);
+
+        Node* child(int dir) const;
+        void setChild(int dir, Node* node);
+
+        std::atomic<std::uint64_t> version;
+        std::atomic<Value*> value;
+        std::atomic<Link*> parent;
+        std::atomic<Node*> left;
+        std::atomic<Node*> right;
+        std::atomic<int> height;
+        SpinLock lock;
+    };
+
+    struct Node : Link
+    {
+        Node(const Key& key, Value* value, Link* parent);
+
+        const Key key;
+    };
+
+    // version bits: unlinked for good, mid-rotation, and a change count
+    static const std::uint64_t unlinked = 1;
+    static const std::uint64_t shrinking = 2;
+    static const std::uint64_t changeCount = 4;
+
+    // attemptGet() and attemptUpdate() results
+    enum Result { Retry, Absent, Present };
+
+    // nodeCondition() results other than a new height
+    static const int nothingRequired = -1;
+    static const int rebalanceRequired = -2;
+    static const int unlinkRequired = -3;
+
+    int compare(const Key& key, const Node* node) const;
+    static int height(const Node* node);
+    static void waitUntilNotChanging(Link* node);
+    static void destroyNode(void* node);
+    static void destroyValue(void* value);
+
+    Result attemptGet(const Key& key, Link* node, int dir, std::uint64_t nodeVersion, Value* value) const;
+    Result update(const Key& key, Value* value);
+    Result attemptUpdate(const Key& key, Value* value, Link* parent, Node* node, std::uint64_t nodeVersion);
+    Result attemptNodeUpdate(Value* value, Link* parent, Node* node);
+    bool attemptUnlink(Link* parent, Node* node);
+
+    static int nodeCondition(Link* node);
+    Link* fixHeight(Link* node);
+    void fixHeightAndRebalance(Link* node);
+    Link* rebalance(Link* parent, Node* node);
+    Link* rebalanceToRight(Link* parent, Node* node, Node* left, int rightHeight);
+    Link* rebalanceToLeft(Link* parent, Node* node, Node* right, int leftHeight);
+    Link* rotateRight(Link* parent, Node* node, Node* left, int rightHeight,
+                      int leftLeftHeight, Node* leftRight, int leftRightHeight);
+    Link* rotateLeft(Link* parent, Node* node, int leftHeight, Node* right,
+                     Node* rightLeft, int rightLeftHeight, int rightRightHeight);
+    Link* rotateRightOverLeft(Link* parent, Node* node, Node* left, int rightHeight,
+                              int leftLeftHeight, Node* leftRight, int leftRightLeftHeight);
+    Link* rotateLeftOverRight(Link* parent, Node* node, int leftHeight, Node* right,
+                              Node* rightLeft, int rightRightHeight, int rightLeftRightHeight);
+
+    // declared first so that it outlives the nodes it may still free
+    mutable EpochManager epochs_;
+    // never holds an entry; the tree hangs off its right link
+    Link holder_;
+    std::atomic<std::size_t> size_;
+    Compare comp_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  ---------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::SpinLock::SpinLock() :
+    locked_(false)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::SpinLock::lock()
+{
+    while (locked_.exchange(true, std::memory_order_acquire)) {
+        while (locked_.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::SpinLock::unlock()
+{
+    locked_.store(false, std::memory_order_release);
+}
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::Link::Link(Value* value, Link* parent) :
+    version(0),
+    value(value),
+    parent(parent),
+    left(nullptr),
+    right(nullptr),
+    height(1)
+{
+
+}
+
+/**
+* The left child for a negative dir, else the right one.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::Link::child(int dir) const
+{
+    return dir < 0 ? left.load() : right.load();
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::Link::setChild(int dir, Node* node)
+{
+    if (dir < 0) {
+        left.store(node);
+    } else {
+        right.store(node);
+    }
+}
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::Node::Node(const Key& key, Value* value, Link* parent) :
+    Link(value, parent),
+    key(key)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree() :
+    holder_(nullptr, nullptr),
+    size_(0),
+    comp_()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree(const Compare& comp) :
+    holder_(nullptr, nullptr),
+    size_(0),
+    comp_(comp)
+{
+
+}
+
+/**
+* Frees every node still linked in; the EpochManager then frees the
+* ones that were waiting. No other thread may be using the tree.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::~ConcurrentAVLTree()
+{
+    std::vector<Node*> pending;
+    if (holder_.right.load() != nullptr) {
+        pending.push_back(holder_.right.load());
+    }
+    while (!pending.empty()) {
+        Node* node = pending.back();
+        pending.pop_back();
+        if (node->left.load() != nullptr) {
+            pending.push_back(node->left.load());
+        }
+        if (node->right.load() != nullptr) {
+            pending.push_back(node->right.load());
+        }
+        delete node->value.load();
+        delete node;
+    }
+}
+
+/**
+* Copies the value stored under key into value. Returns false, leaving
+* value alone, if the key is not there.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    EpochManager::Guard guard(epochs_);
+    Result result;
+    do {
+        result = attemptGet(key, const_cast<Link*>(&holder_), 1, 0, &value);
+    } while (result == Retry);
+    return result == Present;
+}
+
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    EpochManager::Guard guard(epochs_);
+    Result result;
+    do {
+        result = attemptGet(key, const_cast<Link*>(&holder_), 1, 0, nullptr);
+    } while (result == Retry);
+    return result == Present;
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already there.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    EpochManager::Guard guard(epochs_);
+    if (update(keyValuePair.first, new Value(keyValuePair.second)) == Absent) {
+        size_.fetch_add(1);
+    }
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    EpochManager::Guard guard(epochs_);
+    if (update(key, nullptr) == Present) {
+        size_.fetch_sub(1);
+    }
+}
+
+/**
+* The number of keys; only a snapshot while writers are busy.
+*/
+template<class Key, class Value, class Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::size() const
+{
+    return size_.load();
+}
+
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_.load() == 0;
+}
+
+/**
+* -1, 0 or 1 as key sorts before, with or after node's key.
+*/
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::compare(const Key& key, const Node* node) const
+{
+    if (comp_(key, node->key)) {
+        return -1;
+    }
+    return comp_(node->key, key) ? 1 : 0;
+}
+
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::height(const Node* node)
+{
+    return node == nullptr ? 0 : node->height.load();
+}
+
+/**
+* Spins briefly while a rotation is moving node, then waits on its lock,
+* which the rotation holds until it is done.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::waitUntilNotChanging(Link* node)
+{
+    std::uint64_t version = node->version.load();
+    if ((version & shrinking) == 0) {
+        return;
+    }
+    for (int i = 0; i < 100; ++i) {
+        if (node->version.load() != version) {
+            return;
+        }
+    }
+    std::lock_guard<SpinLock> guard(node->lock);
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::destroyNode(void* node)
+{
+    delete static_cast<Node*>(node);
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::destroyValue(void* value)
+{
+    delete static_cast<Value*>(value);
+}
+
+/**
+* Looks for key below node, which was at nodeVersion when the caller
+* stepped onto it, in the subtree on side dir. Returns Retry if node
+* changed under us, in which case the caller tries again one level up.
+* A routing node for the key counts as Absent.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptGet(const Key& key, Link* node, int dir,
+                                                   std::uint64_t nodeVersion, Value* value) const
+{
+    while (true) {
+        Node* child = node->child(dir);
+        if (node->version.load() != nodeVersion) {
+            return Retry;
+        }
+        if (child == nullptr) {
+            return Absent;
+        }
+        int childDir = compare(key, child);
+        if (childDir == 0) {
+            Value* found = child->value.load();
+            if (found == nullptr) {
+                return Absent;
+            }
+            if (value != nullptr) {
+                *value = *found;
+            }
+            return Present;
+        }
+        std::uint64_t childVersion = child->version.load();
+        if ((childVersion & (shrinking | unlinked)) != 0) {
+            waitUntilNotChanging(child);
+        }
+        else if (child == node->child(dir)) {
+            // child's version was read while it was still our child
+            if (node->version.load() != nodeVersion) {
+                return Retry;
+            }
+            Result result = attemptGet(key, child, childDir, childVersion, value);
+            if (result != Retry) {
+                return result;
+            }
+        }
+    }
+}
+
+/**
+* Stores value under key, or removes key if value is NULL, and reports
+* whether the key was there before. Takes ownership of value.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::update(const Key& key, Value* value)
+{
+    while (true) {
+        Node* root = holder_.right.load();
+        if (root == nullptr) {
+            if (value == nullptr) {
+                return Absent;
+            }
+            std::lock_guard<SpinLock> guard(holder_.lock);
+            if (holder_.right.load() == nullptr) {
+                holder_.right.store(new Node(key, value, &holder_));
+                return Absent;
+            }
+            continue;
+        }
+        std::uint64_t rootVersion = root->version.load();
+        if ((rootVersion & (shrinking | unlinked)) != 0) {
+            waitUntilNotChanging(root);
+        }
+        else if (root == holder_.right.load()) {
+            Result result = attemptUpdate(key, value, &holder_, root, rootVersion);
+            if (result != Retry) {
+                return result;
+            }
+        }
+    }
+}
+
+/**
+* Does update() below node, which was at nodeVersion when the caller
+* stepped onto it from parent. A missing key is added as a new leaf
+* under node's lock only.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptUpdate(const Key& key, Value* value, Link* parent,
+                                                      Node* node, std::uint64_t nodeVersion)
+{
+    int dir = compare(key, node);
+    if (dir == 0) {
+        return attemptNodeUpdate(value, parent, node);
+    }
+    while (true) {
+        Node* child = node->child(dir);
+        if (node->version.load() != nodeVersion) {
+            return Retry;
+        }
+        if (child == nullptr) {
+            if (value == nullptr) {
+                return Absent;
+            }
+            Link* damaged;
+            {
+                std::lock_guard<SpinLock> guard(node->lock);
+                if (node->version.load() != nodeVersion) {
+                    return Retry;
+                }
+                if (node->child(dir) != nullptr) {
+                    // someone else got there first; look again
+                    continue;
+                }
+                node->setChild(dir, new Node(key, value, node));
+                damaged = fixHeight(node);
+            }
+            fixHeightAndRebalance(damaged);
+            return Absent;
+        }
+        std::uint64_t childVersion = child->version.load();
+        if ((childVersion & (shrinking | unlinked)) != 0) {
+            waitUntilNotChanging(child);
+        }
+        else if (child == node->child(dir)) {
+            if (node->version.load() != nodeVersion) {
+                return Retry;
+            }
+            Result result = attemptUpdate(key, value, node, child, childVersion);
+            if (result != Retry) {
+                return result;
+            }
+        }
+    }
+}
+
+/**
+* Updates node, which holds the key. A remove unlinks node if it has at
+* most one child and otherwise just turns it into a routing node.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptNodeUpdate(Value* value, Link* parent, Node* node)
+{
+    if (value == nullptr && node->value.load() == nullptr) {
+        return Absent;
+    }
+
+    if (value == nullptr && (node->left.load() == nullptr || node->right.load() == nullptr)) {
+        Value* old;
+        Link* damaged;
+        {
+            std::lock_guard<SpinLock> parentGuard(parent->lock);
+            if ((parent->version.load() & unlinked) != 0 || node->parent.load() != parent) {
+                return Retry;
+            }
+            std::lock_guard<SpinLock> nodeGuard(node->lock);
+            old = node->value.load();
+            if (old == nullptr) {
+                return Absent;
+            }
+            if (!attemptUnlink(parent, node)) {
+                return Retry;
+            }
+            damaged = fixHeight(parent);
+        }
+        epochs_.retire(old, destroyValue);
+        epochs_.retire(node, destroyNode);
+        fixHeightAndRebalance(damaged);
+        return Present;
+    }
+
+    Value* old;
+    {
+        std::lock_guard<SpinLock> guard(node->lock);
+        if ((node->version.load() & unlinked) != 0) {
+            return Retry;
+        }
+        old = node->value.load();
+        if (value == nullptr) {
+            if (old == nullptr) {
+                return Absent;
+            }
+            if (node->left.load() == nullptr || node->right.load() == nullptr) {
+                // lost a child meanwhile, so it has to be unlinked instead
+                return Retry;
+            }
+        }
+        node->value.store(value);
+    }
+    if (old == nullptr) {
+        return Absent;
+    }
+    epochs_.retire(old, destroyValue);
+    return Present;
+}
+
+/**
+* Splices out node, which has at most one child, with parent and node
+* both locked. Returns false if the links are not as expected any more.
+* The caller retires node.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::attemptUnlink(Link* parent, Node* node)
+{
+    Node* parentLeft = parent->left.load();
+    if (parentLeft != node && parent->right.load() != node) {
+        return false;
+    }
+    Node* left = node->left.load();
+    Node* right = node->right.load();
+    if (left != nullptr && right != nullptr) {
+        return false;
+    }
+    Node* splice = left != nullptr ? left : right;
+    if (parentLeft == node) {
+        parent->left.store(splice);
+    } else {
+        parent->right.store(splice);
+    }
+    if (splice != nullptr) {
+        splice->parent.store(parent);
+    }
+    node->version.store(unlinked);
+    node->value.store(nullptr);
+    return true;
+}
+
+/**
+* What node needs: unlinking if it is a routing node with a free child
+* link, a rotation if it is out of balance, otherwise its correct height,
+* or nothingRequired if that is what it already has.
+*/
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::nodeCondition(Link* node)
+{
+    Node* left = node->left.load();
+    Node* right = node->right.load();
+    if ((left == nullptr || right == nullptr) && node->value.load() == nullptr) {
+        return unlinkRequired;
+    }
+    int leftHeight = height(left);
+    int rightHeight = height(right);
+    int newHeight = 1 + std::max(leftHeight, rightHeight);
+    if (leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1) {
+        return rebalanceRequired;
+    }
+    return node->height.load() != newHeight ? newHeight : nothingRequired;
+}
+
+/**
+* Corrects node's height, with node locked. Returns the next node that
+* may need attention: node itself if it needs more than a new height,
+* its parent if the height changed, or NULL.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Link*
+ConcurrentAVLTree<Key, Value, Compare>::fixHeight(Link* node)
+{
+    int condition = nodeCondition(node);
+    if (condition == rebalanceRequired || condition == unlinkRequired) {
+        return node;
+    }
+    if (condition == nothingRequired) {
+        return nullptr;
+    }
+    node->height.store(condition);
+    return node->parent.load();
+}
+
+/**
+* Walks up from node fixing heights, rotating and unlinking routing nodes
+* until nothing more needs doing. Stops at the root holder, which has no
+* parent.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::fixHeightAndRebalance(Link* node)
+{
+    while (node != nullptr && node->parent.load() != nullptr) {
+        int condition = nodeCondition(node);
+        if (condition == nothingRequired || (node->version.load() & unlinked) != 0) {
+            return;
+        }
+        if (condition != unlinkRequired && condition != rebalanceRequired) {
+            std::lock_guard<SpinLock> guard(node->lock);
+            node = fixHeight(node);
+        }
+        else {
+            Link* parent = node->parent.load();
+            std::lock_guard<SpinLock> parentGuard(parent->lock);
+            if ((parent->version.load() & unlinked) == 0 && node->parent.load() == parent) {
+                std::lock_guard<SpinLock> nodeGuard(node->lock);
+                node = rebalance(parent, static_cast<Node*>(node));
+            }
+        }
+    }
+}
+
+/**
+* Unlinks, rotates or re-heights node, with parent and node locked, and
+* returns the next node to look at as fixHeight() does.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Link*
+ConcurrentAVLTree<Key, Value, Compare>::rebalance(Link* parent, Node* node)
+{
+    Node* left = node->left.load();
+    Node* right = node->right.load();
+    if ((left == nullptr || right == nullptr) && node->value.load() == nullptr) {
+        if (attemptUnlink(parent, node)) {
+            epochs_.retire(node, destroyNode);
+            return fixHeight(parent);
+        }
+        return node;
+    }
+
+    int leftHeight = height(left);
+    int rightHeight = height(right);
+    int newHeight = 1 + std::max(leftHeight, rightHeight);
+    if (leftHeight - rightHeight > 1) {
+        return rebalanceToRight(parent, node, left, rightHeight);
+    }
+    if (rightHeight - leftHeight > 1) {
+        return rebalanceToLeft(parent, node, right, leftHeight);
+    }
+    if (newHeight != node->height.load()) {
+        node->height.store(newHeight);
+        return fixHeight(parent);
+    }
+    return nullptr;
+}
+
+/**
+* Fixes a node whose left side is too tall with a single or double right
+* rotation, locking the children involved. A double rotation that would
+* leave the left child out of balance is done as two steps instead.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Link*
+ConcurrentAVLTree<Key, Value, Compare>::rebalanceToRight(Link* parent, Node* node, Node* left, int rightHeight)
+{
+    std::lock_guard<SpinLock> leftGuard(left->lock);
+    if (left->height.load() - rightHeight <= 1) {
+        return node;
+    }
+    Node* leftRight = left->right.load();
+    int leftLeftHeight = height(left->left.load());
+    int leftRightHeight = height(leftRight);
+    if (leftLeftHeight >= leftRightHeight) {
+        return rotateRight(parent, node, left, rightHeight, leftLeftHeight, leftRight, leftRightHeight);
+    }
+    {
+        std::lock_guard<SpinLock> leftRightGuard(leftRight->lock);
+        leftRightHeight = leftRight->height.load();
+        if (leftLeftHeight >= leftRightHeight) {
+            return rotateRight(parent, node, left, rightHeight, leftLeftHeight, leftRight, leftRightHeight);
+        }
+        int leftRightLeftHeight = height(leftRight->left.load());
+        int balance = leftLeftHeight - leftRightLeftHeight;
+        if (balance >= -1 && balance <= 1 &&
+            !((leftLeftHeight == 0 || leftRightLeftHeight == 0) && left->value.load() == nullptr)) {
+            return rotateRightOverLeft(parent, node, left, rightHeight, leftLeftHeight, leftRight,
+                                       leftRightLeftHeight);
+        }
+    }
+    return rebalanceToLeft(node, left, leftRight, leftLeftHeight);
+}
+
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Link*
+ConcurrentAVLTree<Key, Value, Compare>::rebalanceToLeft(Link* parent, Node* node, Node* right, int leftHeight)
+{
+    std::lock_guard<SpinLock> rightGuard(right->lock);
+    if (right->height.load() - leftHeight <= 1) {
+        return node;
+    }
+    Node* rightLeft = right->left.load();
+    int rightLeftHeight = height(rightLeft);
+    int rightRightHeight = height(right->right.load());
+    if (rightRightHeight >= rightLeftHeight) {
+        return rotateLeft(parent, node, leftHeight, right, rightLeft, rightLeftHeight, rightRightHeight);
+    }
+    {
+        std::lock_guard<SpinLock> rightLeftGuard(rightLeft->lock);
+        rightLeftHeight = rightLeft->height.load();
+        if (rightRightHeight >= rightLeftHeight) {
+            return rotateLeft(parent, node, leftHeight, right, rightLeft, rightLeftHeight, rightRightHeight);
+        }
+        int rightLeftRightHeight = height(rightLeft->right.load());
+        int balance = rightRightHeight - rightLeftRightHeight;
+        if (balance >= -1 && balance <= 1 &&
+            !((rightRightHeight == 0 || rightLeftRightHeight == 0) && right->value.load() == nullptr)) {
+            return rotateLeftOverRight(parent, node, leftHeight, right, rightLeft, rightRightHeight,
+                                       rightLeftRightHeight);
+        }
+    }
+    return rebalanceToRight(node, right, rightLeft, rightRightHeight);
+}
+
+/**
+* Rotates node down to the right under its left child. node shrinks, so
+* its version is marked while the links change; readers on node retry.
+* Returns whichever node still needs work, as fixHeight() does.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Link*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRight(Link* parent, Node* node, Node* left, int rightHeight,
+                                                    int leftLeftHeight, Node* leftRight, int leftRightHeight)
+{
+    std::uint64_t nodeVersion = node->version.load();
+    Node* parentLeft = parent->left.load();
+    node->version.store(nodeVersion | shrinking);
+
+    node->left.store(leftRight);
+    if (leftRight != nullptr) {
+        leftRight->parent.store(node);
+    }
+    left->right.store(node);
+    node->parent.store(left);
+    if (parentLeft == node) {
+        parent->left.store(left);
+    } else {
+        parent->right.store(left);
+    }
+    left->parent.store(parent);
+
+    int nodeHeight = 1 + std::max(leftRightHeight, rightHeight);
+    node->height.store(nodeHeight);
+    left->height.store(1 + std::max(leftLeftHeight, nodeHeight));
+    node->version.store(nodeVersion + changeCount);
+
+    int nodeBalance = leftRightHeight - rightHeight;
+    if (nodeBalance < -1 || nodeBalance > 1) {
+        return node;
+    }
+    if ((leftRight == nullptr || rightHeight == 0) && node->value.load() == nullptr) {
+        return node;
+    }
+    int leftBalance = leftLeftHeight - nodeHeight;
+    if (leftBalance < -1 || leftBalance > 1) {
+        return left;
+    }
+    if (leftLeftHeight == 0 && left->value.load() == nullptr) {
+        return left;
+    }
+    return fixHeight(parent);
+}
+
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Link*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeft(Link* parent, Node* node, int leftHeight, Node* right,
+                                                   Node* rightLeft, int rightLeftHeight, int rightRightHeight)
+{
+    std::uint64_t nodeVersion = node->version.load();
+    Node* parentLeft = parent->left.load();
+    node->version.store(nodeVersion | shrinking);
+
+    node->right.store(rightLeft);
+    if (rightLeft != nullptr) {
+        rightLeft->parent.store(node);
+    }
+    right->left.store(node);
+    node->parent.store(right);
+    if (parentLeft == node) {
+        parent->left.store(right);
+    } else {
+        parent->right.store(right);
+    }
+    right->parent.store(parent);
+
+    int nodeHeight = 1 + std::max(leftHeight, rightLeftHeight);
+    node->height.store(nodeHeight);
+    right->height.store(1 + std::max(nodeHeight, rightRightHeight));
+    node->version.store(nodeVersion + changeCount);
+
+    int nodeBalance = rightLeftHeight - leftHeight;
+    if (nodeBalance < -1 || nodeBalance > 1) {
+        return node;
+    }
+    if ((rightLeft == nullptr || leftHeight == 0) && node->value.load() == nullptr) {
+        return node;
+    }
+    int rightBalance = rightRightHeight - nodeHeight;
+    if (rightBalance < -1 || rightBalance > 1) {
+        return right;
+    }
+    if (rightRightHeight == 0 && right->value.load() == nullptr) {
+        return right;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* Double rotation: node's left child's right child rises above both.
+* node and its left child both shrink.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Link*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRightOverLeft(Link* parent, Node* node, Node* left, int rightHeight,
+                                                            int leftLeftHeight, Node* leftRight,
+                                                            int leftRightLeftHeight)
+{
+    std::uint64_t nodeVersion = node->version.load();
+    std::uint64_t leftVersion = left->version.load();
+    Node* parentLeft = parent->left.load();
+    Node* leftRightLeft = leftRight->left.load();
+    Node* leftRightRight = leftRight->right.load();
+    int leftRightRightHeight = height(leftRightRight);
+    node->version.store(nodeVersion | shrinking);
+    left->version.store(leftVersion | shrinking);
+
+    node->left.store(leftRightRight);
+    if (leftRightRight != nullptr) {
+        leftRightRight->parent.store(node);
+    }
+    left->right.store(leftRightLeft);
+    if (leftRightLeft != nullptr) {
+        leftRightLeft->parent.store(left);
+    }
+    leftRight->left.store(left);
+    left->parent.store(leftRight);
+    leftRight->right.store(node);
+    node->parent.store(leftRight);
+    if (parentLeft == node) {
+        parent->left.store(leftRight);
+    } else {
+        parent->right.store(leftRight);
+    }
+    leftRight->parent.store(parent);
+
+    int nodeHeight = 1 + std::max(leftRightRightHeight, rightHeight);
+    node->height.store(nodeHeight);
+    int leftHeight = 1 + std::max(leftLeftHeight, leftRightLeftHeight);
+    left->height.store(leftHeight);
+    leftRight->height.store(1 + std::max(leftHeight, nodeHeight));
+    node->version.store(nodeVersion + changeCount);
+    left->version.store(leftVersion + changeCount);
+
+    int nodeBalance = leftRightRightHeight - rightHeight;
+    if (nodeBalance < -1 || nodeBalance > 1) {
+        return node;
+    }
+    if ((leftRightRight == nullptr || rightHeight == 0) && node->value.load() == nullptr) {
+        return node;
+    }
+    int topBalance = leftHeight - nodeHeight;
+    if (topBalance < -1 || topBalance > 1) {
+        return leftRight;
+    }
+    return fixHeight(parent);
+}
+
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Link*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeftOverRight(Link* parent, Node* node, int leftHeight, Node* right,
+                                                            Node* rightLeft, int rightRightHeight,
+                                                            int rightLeftRightHeight)
+{
+    std::uint64_t nodeVersion = node->version.load();
+    std::uint64_t rightVersion = right->version.load();
+    Node* parentLeft = parent->left.load();
+    Node* rightLeftLeft = rightLeft->left.load();
+    Node* rightLeftRight = rightLeft->right.load();
+    int rightLeftLeftHeight = height(rightLeftLeft);
+    node->version.store(nodeVersion | shrinking);
+    right->version.store(rightVersion | shrinking);
+
+    node->right.store(rightLeftLeft);
+    if (rightLeftLeft != nullptr) {
+        rightLeftLeft->parent.store(node);
+    }
+    right->left.store(rightLeftRight);
+    if (rightLeftRight != nullptr) {
+        rightLeftRight->parent.store(right);
+    }
+    rightLeft->right.store(right);
+    right->parent.store(rightLeft);
+    rightLeft->left.store(node);
+    node->parent.store(rightLeft);
+    if (parentLeft == node) {
+        parent->left.store(rightLeft);
+    } else {
+        parent->right.store(rightLeft);
+    }
+    rightLeft->parent.store(parent);
+
+    int nodeHeight = 1 + std::max(leftHeight, rightLeftLeftHeight);
+    node->height.store(nodeHeight);
+    int rightHeight = 1 + std::max(rightLeftRightHeight, rightRightHeight);
+    right->height.store(rightHeight);
+    rightLeft->height.store(1 + std::max(nodeHeight, rightHeight));
+    node->version.store(nodeVersion + changeCount);
+    right->version.store(rightVersion + changeCount);
+
+    int nodeBalance = rightLeftLeftHeight - leftHeight;
+    if (nodeBalance < -1 || nodeBalance > 1) {
+        return node;
+    }
+    if ((rightLeftLeft == nullptr || leftHeight == 0) && node->value.load() == nullptr) {
+        return node;
+    }
+    int topBalance = rightHeight - nodeHeight;
+    if (topBalance < -1 || topBalance > 1) {
+        return rightLeft;
+    }
+    return fixHeight(parent);
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  ---------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,857 @@
+#ifndef DISK_TREE_H
+#define DISK_TREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "buffer_pool.h"
+
+/**
+* The start of every DiskTree node page, laid over the page's bytes. A
+* leaf holds count keys and then, further on, their values. An inner
+* node holds count keys and count + 1 child page numbers: children()[i]
+* leads to the keys below keys()[i], and children()[i + 1] to those from
+* keys()[i] on.
+*/
+template <typename Key, typename Value>
+struct DiskTreeNode
+{
+    static const std::size_t pageSize = 4096;
+    static const std::size_t headerSize = 16;
+    static const int leafCapacity =
+        static_cast<int>((pageSize - headerSize - 16) / (sizeof(Key) + sizeof(Value)));
+    static const int innerCapacity =
+        static_cast<int>((pageSize - headerSize - 16 - sizeof(uint64_t)) / (sizeof(Key) + sizeof(uint64_t)));
+
+    Key* keys();
+    Value* values();
+    uint64_t* children();
+
+    uint32_t leaf;
+    uint32_t count;
+    // the next leaf in key order, or 0 after the last
+    uint64_t next;
+};
+
+template<typename Key, typename Value>
+Key* DiskTreeNode<Key, Value>::keys()
+{
+    std::size_t offset = headerSize;
+    if (!leaf) {
+        offset += (innerCapacity + 1) * sizeof(uint64_t);
+    }
+    return reinterpret_cast<Key*>(reinterpret_cast<char*>(this) + (offset + 15) / 16 * 16);
+}
+
+template<typename Key, typename Value>
+Value* DiskTreeNode<Key, Value>::values()
+{
+    std::size_t offset = headerSize + leafCapacity * sizeof(Key);
+    return reinterpret_cast<Value*>(reinterpret_cast<char*>(this) + (offset + 15) / 16 * 16);
+}
+
+template<typename Key, typename Value>
+uint64_t* DiskTreeNode<Key, Value>::children()
+{
+    return reinterpret_cast<uint64_t*>(reinterpret_cast<char*>(this) + headerSize);
+}
+
+/**
+* Page 0 of a DiskTree file.
+*/
+struct DiskTreeMeta
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t pageSize;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t root;
+    uint64_t first;
+    uint64_t count;
+    // the first page of a chain of free pages, each holding the next
+    // one's number in its first bytes
+    uint64_t freeHead;
+};
+
+static const char DISK_TREE_MAGIC[8] = { 'B', 'S', 'T', 'D', 'I', 'S', 'K', '\0' };
+static const uint32_t DISK_TREE_VERSION = 1;
+
+/**
+* A B+ tree kept in a file of 4 KB pages rather than in memory, for key
+* sets larger than RAM. Pages are read through a BufferPool holding at
+* most cacheBytes of them and evicting the least recently used; changed
+* pages go back to the file when evicted or on flush(). The interface
+* follows BinarySearchTree's, and opening an existing file carries on
+* where it was left.
+*
+* Keys and values are stored as raw bytes, so both must be trivially
+* copyable. Iterators hand out copies of the items and are forward only;
+* inserting or removing invalidates them. The file is only consistent
+* after flush() or destruction.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class DiskTree
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "DiskTree needs trivially copyable keys and values");
+    static_assert(alignof(Key) <= 16 && alignof(Value) <= 16,
+                  "DiskTree aligns keys and values to at most 16 bytes");
+    static_assert(DiskTreeNode<Key, Value>::leafCapacity >= 3 && DiskTreeNode<Key, Value>::innerCapacity >= 3,
+                  "DiskTree needs room for three items in a page");
+
+public:
+    DiskTree(const std::string& path, std::size_t cacheBytes, const Compare& comp = Compare());
+    ~DiskTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    void flush();
+    bool empty() const;
+    std::size_t size() const;
+    Compare key_comp() const;
+    BufferPool::Stats cacheStats() const;
+    void resetCacheStats();
+
+    /**
+    * A forward iterator over the contents in key order: a leaf page and a
+    * slot in it. It holds a copy of the item it is on.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<Key, Value>* pointer;
+        typedef const std::pair<Key, Value>& reference;
+
+        const_iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+
+    protected:
+        friend class DiskTree<Key, Value, Compare>;
+        const_iterator(const DiskTree<Key, Value, Compare>* tree, uint64_t page, int index);
+        void load();
+
+        const DiskTree<Key, Value, Compare>* tree_;
+        uint64_t page_;
+        int index_;
+        std::pair<Key, Value> item_;
+    };
+    typedef const_iterator iterator;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+    Value operator[](const Key& key) const;
+
+protected:
+    typedef DiskTreeNode<Key, Value> Node;
+    typedef BufferPool::Page Page;
+
+    static const int leafCapacity = Node::leafCapacity;
+    static const int innerCapacity = Node::innerCapacity;
+
+    static Node* node(const Page& page);
+    static int capacity(const Node* node);
+    static int minCount(const Node* node);
+
+    int lowerIndex(Node* node, const Key& key) const;
+    int upperIndex(Node* node, const Key& key) const;
+    const_iterator bound(const Key& key, bool upper) const;
+
+    Page pin(uint64_t page) const;
+    Page createNode(bool leaf);
+    void destroyNode(Page& page);
+    void writeMeta();
+
+    static void leafInsert(Node* leaf, int pos, const Key& key, const Value& value);
+    static void leafErase(Node* leaf, int pos);
+    static void innerInsert(Node* inner, int pos, const Key& key, uint64_t right);
+    static void innerErase(Node* inner, int pos);
+
+    Page splitChild(Node* parent, int i, Page& child);
+    int fixChild(Node* parent, int i);
+    void mergeChildren(Node* parent, int i, Page& left, Page& right);
+
+    // pinning changes the cache even for lookups
+    mutable BufferPool pool_;
+    uint64_t root_;
+    uint64_t first_;
+    std::size_t size_;
+    uint64_t freeHead_;
+    Compare comp_;
+};
+
+/*
+-------------------------------------------------------------
+Begin implementations for the DiskTree::const_iterator class.
+-------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+DiskTree<Key, Value, Compare>::const_iterator::const_iterator() :
+    tree_(nullptr),
+    page_(0),
+    index_(0),
+    item_()
+{
+
+}
+
+/**
+* An iterator at slot index of leaf page, or end() if page is 0.
+*/
+template<class Key, class Value, class Compare>
+DiskTree<Key, Value, Compare>::const_iterator::const_iterator(const DiskTree<Key, Value, Compare>* tree,
+                                                              uint64_t page, int index) :
+    tree_(tree),
+    page_(page),
+    index_(index),
+    item_()
+{
+    load();
+}
+
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::const_iterator::reference
+DiskTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return item_;
+}
+
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::const_iterator::pointer
+DiskTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &item_;
+}
+
+template<class Key, class Value, class Compare>
+bool DiskTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return page_ == rhs.page_ && index_ == rhs.index_;
+}
+
+template<class Key, class Value, class Compare>
+bool DiskTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::const_iterator&
+DiskTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    index_++;
+    load();
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::const_iterator
+DiskTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++*this;
+    return old;
+}
+
+/**
+* Copies out the item at index_, first moving on to the next leaf if
+* index_ has run off the end of this one.
+*/
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::const_iterator::load()
+{
+    while (page_ != 0) {
+        Page page = tree_->pin(page_);
+        Node* leaf = node(page);
+        if (index_ < static_cast<int>(leaf->count)) {
+            item_.first = leaf->keys()[index_];
+            item_.second = leaf->values()[index_];
+            return;
+        }
+        page_ = leaf->next;
+        index_ = 0;
+    }
+}
+
+/*
+-----------------------------------------------------------
+End implementations for the DiskTree::const_iterator class.
+-----------------------------------------------------------
+*/
+
+/*
+---------------------------------------------
+Begin implementations for the DiskTree class.
+---------------------------------------------
+*/
+
+/**
+* Opens the tree stored at path, or starts an empty one there if the
+* file is new or empty, keeping up to cacheBytes of pages in memory.
+* Throws std::runtime_error if the file holds something else.
+*/
+template<class Key, class Value, class Compare>
+DiskTree<Key, Value, Compare>::DiskTree(const std::string& path, std::size_t cacheBytes, const Compare& comp) :
+    pool_(path, Node::pageSize, cacheBytes),
+    root_(0),
+    first_(0),
+    size_(0),
+    freeHead_(0),
+    comp_(comp)
+{
+    if (pool_.pageCount() == 0) {
+        pool_.allocate();
+        writeMeta();
+        return;
+    }
+    Page page = pin(0);
+    DiskTreeMeta meta;
+    std::memcpy(&meta, page.data(), sizeof(meta));
+    if (std::memcmp(meta.magic, DISK_TREE_MAGIC, sizeof(meta.magic)) != 0 ||
+        meta.version != DISK_TREE_VERSION || meta.pageSize != Node::pageSize) {
+        throw std::runtime_error("disk tree: " + path + " is not a tree file");
+    }
+    if (meta.keySize != sizeof(Key) || meta.valueSize != sizeof(Value)) {
+        throw std::runtime_error("disk tree: " + path + " holds keys or values of another size");
+    }
+    root_ = meta.root;
+    first_ = meta.first;
+    size_ = static_cast<std::size_t>(meta.count);
+    freeHead_ = meta.freeHead;
+}
+
+/**
+* Flushes the tree; errors are lost, so call flush() first to see them.
+*/
+template<class Key, class Value, class Compare>
+DiskTree<Key, Value, Compare>::~DiskTree()
+{
+    try {
+        writeMeta();
+    }
+    catch (const std::runtime_error&) {
+    }
+}
+
+/**
+* Inserts the pair, or overwrites the value if the key is already there.
+* Full nodes met on the way down are split before stepping into them, so
+* there is always room for the separator a split pushes up.
+*/
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    const Key& key = keyValuePair.first;
+    if (root_ == 0) {
+        Page leaf = createNode(true);
+        root_ = first_ = leaf.id();
+    }
+    Page page = pin(root_);
+    if (static_cast<int>(node(page)->count) == capacity(node(page))) {
+        Page root = createNode(false);
+        node(root)->children()[0] = root_;
+        root_ = root.id();
+        splitChild(node(root), 0, page);
+        page = std::move(root);
+    }
+    while (!node(page)->leaf) {
+        Node* inner = node(page);
+        int i = upperIndex(inner, key);
+        Page child = pin(inner->children()[i]);
+        if (static_cast<int>(node(child)->count) == capacity(node(child))) {
+            Page right = splitChild(inner, i, child);
+            page.markDirty();
+            if (!comp_(key, inner->keys()[i])) {
+                child = std::move(right);
+            }
+        }
+        page = std::move(child);
+    }
+    Node* leaf = node(page);
+    int pos = lowerIndex(leaf, key);
+    page.markDirty();
+    if (pos < static_cast<int>(leaf->count) && !comp_(key, leaf->keys()[pos])) {
+        leaf->values()[pos] = keyValuePair.second;
+        return;
+    }
+    leafInsert(leaf, pos, key, keyValuePair.second);
+    size_++;
+}
+
+/**
+* Removes key if it is there. On the way down, a child left with the
+* fewest keys allowed first takes one from a sibling or merges with it,
+* so that taking a key out below never leaves a node short.
+*/
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::remove(const Key& key)
+{
+    if (root_ == 0) {
+        return;
+    }
+    Page page = pin(root_);
+    while (!node(page)->leaf) {
+        Node* inner = node(page);
+        int i = upperIndex(inner, key);
+        Page child = pin(inner->children()[i]);
+        if (static_cast<int>(node(child)->count) <= minCount(node(child))) {
+            child.release();
+            i = fixChild(inner, i);
+            page.markDirty();
+            child = pin(inner->children()[i]);
+        }
+        if (page.id() == root_ && inner->count == 0) {
+            // the root's last two children merged
+            root_ = child.id();
+            destroyNode(page);
+        }
+        page = std::move(child);
+    }
+    Node* leaf = node(page);
+    int pos = lowerIndex(leaf, key);
+    if (pos == static_cast<int>(leaf->count) || comp_(key, leaf->keys()[pos])) {
+        return;
+    }
+    leafErase(leaf, pos);
+    page.markDirty();
+    size_--;
+    if (leaf->count == 0) {
+        // only the root may run empty
+        destroyNode(page);
+        root_ = first_ = 0;
+    }
+}
+
+/**
+* Empties the tree and shrinks the file back to its first page.
+*/
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::clear()
+{
+    pool_.truncate(1);
+    root_ = first_ = 0;
+    size_ = 0;
+    freeHead_ = 0;
+    writeMeta();
+}
+
+/**
+* Writes every changed page back to the file and syncs it.
+*/
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::flush()
+{
+    writeMeta();
+    pool_.flush();
+}
+
+template<class Key, class Value, class Compare>
+bool DiskTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t DiskTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value, class Compare>
+Compare DiskTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+template<class Key, class Value, class Compare>
+BufferPool::Stats DiskTree<Key, Value, Compare>::cacheStats() const
+{
+    return pool_.stats();
+}
+
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::resetCacheStats()
+{
+    pool_.resetStats();
+}
+
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::const_iterator
+DiskTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(this, first_, 0);
+}
+
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::const_iterator
+DiskTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(this, 0, 0);
+}
+
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::const_iterator
+DiskTree<Key, Value, Compare>::find(const Key& key) const
+{
+    const_iterator it = bound(key, false);
+    if (it == end() || comp_(key, it->first)) {
+        return end();
+    }
+    return it;
+}
+
+/**
+* The first item whose key is not less than key.
+*/
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::const_iterator
+DiskTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return bound(key, false);
+}
+
+/**
+* The first item whose key is greater than key.
+*/
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::const_iterator
+DiskTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return bound(key, true);
+}
+
+/**
+* The value stored under key, by copy since it lives in a page.
+*/
+template<class Key, class Value, class Compare>
+Value DiskTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    const_iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::Node*
+DiskTree<Key, Value, Compare>::node(const Page& page)
+{
+    return reinterpret_cast<Node*>(page.data());
+}
+
+template<class Key, class Value, class Compare>
+int DiskTree<Key, Value, Compare>::capacity(const Node* node)
+{
+    if (node->leaf) {
+        return leafCapacity;
+    }
+    return innerCapacity;
+}
+
+/**
+* Fewest keys in any node but the root; a full node splits into halves
+* no smaller than this.
+*/
+template<class Key, class Value, class Compare>
+int DiskTree<Key, Value, Compare>::minCount(const Node* node)
+{
+    return (capacity(node) - 1) / 2;
+}
+
+/**
+* The number of keys in node less than key. Nodes are a page wide, so
+* this is a binary search.
+*/
+template<class Key, class Value, class Compare>
+int DiskTree<Key, Value, Compare>::lowerIndex(Node* node, const Key& key) const
+{
+    return static_cast<int>(std::lower_bound(node->keys(), node->keys() + node->count, key, comp_) - node->keys());
+}
+
+/**
+* The number of keys in node not greater than key, which is also the
+* child of an inner node to follow for key.
+*/
+template<class Key, class Value, class Compare>
+int DiskTree<Key, Value, Compare>::upperIndex(Node* node, const Key& key) const
+{
+    return static_cast<int>(std::upper_bound(node->keys(), node->keys() + node->count, key, comp_) - node->keys());
+}
+
+/**
+* The first item not less than key (greater than key if upper).
+*/
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::const_iterator
+DiskTree<Key, Value, Compare>::bound(const Key& key, bool upper) const
+{
+    if (root_ == 0) {
+        return end();
+    }
+    Page page = pin(root_);
+    while (!node(page)->leaf) {
+        Node* inner = node(page);
+        page = pin(inner->children()[upperIndex(inner, key)]);
+    }
+    Node* leaf = node(page);
+    int index = upper ? upperIndex(leaf, key) : lowerIndex(leaf, key);
+    // past the last key, the iterator moves on to the next leaf itself
+    return const_iterator(this, page.id(), index);
+}
+
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::Page
+DiskTree<Key, Value, Compare>::pin(uint64_t page) const
+{
+    return pool_.pin(page);
+}
+
+/**
+* An empty node in a page off the free list, or a new page at the end of
+* the file if the list is empty.
+*/
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::Page
+DiskTree<Key, Value, Compare>::createNode(bool leaf)
+{
+    Page page;
+    if (freeHead_ != 0) {
+        page = pin(freeHead_);
+        std::memcpy(&freeHead_, page.data(), sizeof(freeHead_));
+        std::memset(page.data(), 0, Node::pageSize);
+    }
+    else {
+        page = pool_.allocate();
+    }
+    node(page)->leaf = leaf;
+    page.markDirty();
+    return page;
+}
+
+/**
+* Puts the node's page on the free list and unpins it.
+*/
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::destroyNode(Page& page)
+{
+    std::memcpy(page.data(), &freeHead_, sizeof(freeHead_));
+    freeHead_ = page.id();
+    page.markDirty();
+    page.release();
+}
+
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::writeMeta()
+{
+    DiskTreeMeta meta;
+    std::memset(&meta, 0, sizeof(meta));
+    std::memcpy(meta.magic, DISK_TREE_MAGIC, sizeof(meta.magic));
+    meta.version = DISK_TREE_VERSION;
+    meta.pageSize = Node::pageSize;
+    meta.keySize = sizeof(Key);
+    meta.valueSize = sizeof(Value);
+    meta.root = root_;
+    meta.first = first_;
+    meta.count = size_;
+    meta.freeHead = freeHead_;
+    Page page = pin(0);
+    std::memcpy(page.data(), &meta, sizeof(meta));
+    page.markDirty();
+}
+
+/**
+* Puts key and value in at pos, moving the items from pos on one slot
+* up. The leaf must have room.
+*/
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::leafInsert(Node* leaf, int pos, const Key& key, const Value& value)
+{
+    int moved = static_cast<int>(leaf->count) - pos;
+    std::memmove(leaf->keys() + pos + 1, leaf->keys() + pos, moved * sizeof(Key));
+    std::memmove(leaf->values() + pos + 1, leaf->values() + pos, moved * sizeof(Value));
+    leaf->keys()[pos] = key;
+    leaf->values()[pos] = value;
+    leaf->count++;
+}
+
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::leafErase(Node* leaf, int pos)
+{
+    int moved = static_cast<int>(leaf->count) - pos - 1;
+    std::memmove(leaf->keys() + pos, leaf->keys() + pos + 1, moved * sizeof(Key));
+    std::memmove(leaf->values() + pos, leaf->values() + pos + 1, moved * sizeof(Value));
+    leaf->count--;
+}
+
+/**
+* Puts key in at pos with right as the child just after it. The node
+* must have room.
+*/
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::innerInsert(Node* inner, int pos, const Key& key, uint64_t right)
+{
+    int moved = static_cast<int>(inner->count) - pos;
+    std::memmove(inner->keys() + pos + 1, inner->keys() + pos, moved * sizeof(Key));
+    std::memmove(inner->children() + pos + 2, inner->children() + pos + 1, moved * sizeof(uint64_t));
+    inner->keys()[pos] = key;
+    inner->children()[pos + 1] = right;
+    inner->count++;
+}
+
+/**
+* Takes out the key at pos and the child just after it.
+*/
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::innerErase(Node* inner, int pos)
+{
+    int moved = static_cast<int>(inner->count) - pos - 1;
+    std::memmove(inner->keys() + pos, inner->keys() + pos + 1, moved * sizeof(Key));
+    std::memmove(inner->children() + pos + 1, inner->children() + pos + 2, moved * sizeof(uint64_t));
+    inner->count--;
+}
+
+/**
+* Splits child, the full child i of parent, in two and puts the key
+* between the halves into parent, which must have room. Returns the new
+* right half, pinned. The caller marks parent dirty.
+*/
+template<class Key, class Value, class Compare>
+typename DiskTree<Key, Value, Compare>::Page
+DiskTree<Key, Value, Compare>::splitChild(Node* parent, int i, Page& child)
+{
+    Node* left = node(child);
+    int half = static_cast<int>(left->count) / 2;
+    Page page = createNode(left->leaf);
+    Node* right = node(page);
+    child.markDirty();
+    if (left->leaf) {
+        right->count = left->count - half;
+        std::memcpy(right->keys(), left->keys() + half, right->count * sizeof(Key));
+        std::memcpy(right->values(), left->values() + half, right->count * sizeof(Value));
+        left->count = half;
+        right->next = left->next;
+        left->next = page.id();
+        innerInsert(parent, i, right->keys()[0], page.id());
+        return page;
+    }
+    right->count = left->count - half - 1;
+    std::memcpy(right->keys(), left->keys() + half + 1, right->count * sizeof(Key));
+    std::memcpy(right->children(), left->children() + half + 1, (right->count + 1) * sizeof(uint64_t));
+    left->count = half;
+    innerInsert(parent, i, left->keys()[half], page.id());
+    return page;
+}
+
+/**
+* Gives child i of parent a key to spare, taking one from a sibling that
+* has more than the minimum or else merging it with a sibling. Returns
+* the index of the child that now covers what child i did. The caller
+* marks parent dirty.
+*/
+template<class Key, class Value, class Compare>
+int DiskTree<Key, Value, Compare>::fixChild(Node* parent, int i)
+{
+    Page childPage = pin(parent->children()[i]);
+    Node* child = node(childPage);
+    if (i > 0) {
+        Page leftPage = pin(parent->children()[i - 1]);
+        Node* left = node(leftPage);
+        if (static_cast<int>(left->count) > minCount(left)) {
+            if (child->leaf) {
+                leafInsert(child, 0, left->keys()[left->count - 1], left->values()[left->count - 1]);
+                leafErase(left, left->count - 1);
+                parent->keys()[i - 1] = child->keys()[0];
+            }
+            else {
+                innerInsert(child, 0, parent->keys()[i - 1], child->children()[0]);
+                child->children()[0] = left->children()[left->count];
+                parent->keys()[i - 1] = left->keys()[left->count - 1];
+                left->count--;
+            }
+            leftPage.markDirty();
+            childPage.markDirty();
+            return i;
+        }
+        if (i == static_cast<int>(parent->count)) {
+            mergeChildren(parent, i - 1, leftPage, childPage);
+            return i - 1;
+        }
+    }
+    Page rightPage = pin(parent->children()[i + 1]);
+    Node* right = node(rightPage);
+    if (static_cast<int>(right->count) > minCount(right)) {
+        if (child->leaf) {
+            leafInsert(child, child->count, right->keys()[0], right->values()[0]);
+            leafErase(right, 0);
+            parent->keys()[i] = right->keys()[0];
+        }
+        else {
+            innerInsert(child, child->count, parent->keys()[i], right->children()[0]);
+            parent->keys()[i] = right->keys()[0];
+            // innerErase drops the child after the key, so shift it first
+            right->children()[0] = right->children()[1];
+            innerErase(right, 0);
+        }
+        rightPage.markDirty();
+        childPage.markDirty();
+        return i;
+    }
+    mergeChildren(parent, i, childPage, rightPage);
+    return i;
+}
+
+/**
+* Moves everything in right, child i + 1 of parent (and, for inner
+* nodes, the key between them), into left, child i, and frees right's
+* page.
+*/
+template<class Key, class Value, class Compare>
+void DiskTree<Key, Value, Compare>::mergeChildren(Node* parent, int i, Page& left, Page& right)
+{
+    Node* to = node(left);
+    Node* from = node(right);
+    if (to->leaf) {
+        std::memcpy(to->keys() + to->count, from->keys(), from->count * sizeof(Key));
+        std::memcpy(to->values() + to->count, from->values(), from->count * sizeof(Value));
+        to->count += from->count;
+        to->next = from->next;
+    }
+    else {
+        to->keys()[to->count] = parent->keys()[i];
+        std::memcpy(to->keys() + to->count + 1, from->keys(), from->count * sizeof(Key));
+        std::memcpy(to->children() + to->count + 1, from->children(), (from->count + 1) * sizeof(uint64_t));
+        to->count += from->count + 1;
+    }
+    left.markDirty();
+    destroyNode(right);
+    innerErase(parent, i);
+}
+
+/*
+-------------------------------------------
+End implementations for the DiskTree class.
+-------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef EPOCH_MANAGER_H
+#define EPOCH_MANAGER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Epoch-based reclamation for structures read without locks.
+ *
+ * A thread holds a Guard while it may be looking at shared objects. An
+ * object that has been unlinked is handed to retire() rather than freed,
+ * and is only destroyed once the global epoch has moved on twice, which
+ * needs every thread inside a Guard to have seen the newer epoch. By then
+ * no reader can still hold a pointer it found before the unlink.
+ *
+ * Entering and leaving a Guard touches only the thread's own record, so
+ * readers never contend. retire() takes a lock, which writers can afford.
+ */
+class EpochManager
+{
+    struct Record;
+
+public:
+    class Guard
+    {
+    public:
+        explicit Guard(EpochManager& manager);
+        ~Guard();
+
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+
+        Record* record_;
+    };
+
+    EpochManager();
+    ~EpochManager();
+
+    void retire(void* object, void (*destroy)(void*));
+
+private:
+    EpochManager(const EpochManager&);
+    EpochManager& operator=(const EpochManager&);
+
+    // state_ is 0 outside a Guard, else the epoch seen on entry * 2 + 1
+    struct Record
+    {
+        std::atomic<std::uint64_t> state;
+        std::thread::id owner;
+        unsigned depth;
+        Record* next;
+    };
+
+    struct Retired
+    {
+        std::uint64_t epoch;
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    static std::uint64_t nextId();
+    Record* record();
+    void tryAdvance();
+    void collect();
+
+    // retiring this many objects triggers an attempt to free some
+    static const std::size_t collectInterval = 64;
+
+    std::uint64_t id_;
+    std::atomic<std::uint64_t> epoch_;
+    std::atomic<Record*> records_;
+    std::mutex retireLock_;
+    std::vector<Retired> retired_;
+    std::size_t sinceCollect_;
+};
+
+inline EpochManager::EpochManager() :
+    id_(nextId()),
+    epoch_(0),
+    records_(nullptr),
+    sinceCollect_(0)
+{
+
+}
+
+/**
+* Destroys everything still waiting to be freed. No Guard may be held.
+*/
+inline EpochManager::~EpochManager()
+{
+    for (std::size_t i = 0; i < retired_.size(); ++i) {
+        retired_[i].destroy(retired_[i].object);
+    }
+    Record* record = records_.load();
+    while (record != nullptr) {
+        Record* next = record->next;
+        delete record;
+        record = next;
+    }
+}
+
+/**
+* Pins the current epoch for this thread. Guards nest.
+*/
+inline EpochManager::Guard::Guard(EpochManager& manager) :
+    record_(manager.record())
+{
+    if (record_->depth++ == 0) {
+        record_->state.store(manager.epoch_.load() * 2 + 1);
+    }
+}
+
+inline EpochManager::Guard::~Guard()
+{
+    if (--record_->depth == 0) {
+        record_->state.store(0);
+    }
+}
+
+/**
+* Queues object for destroy(object) once no reader can still see it. The
+* caller must already have unlinked it.
+*/
+inline void EpochManager::retire(void* object, void (*destroy)(void*))
+{
+    std::lock_guard<std::mutex> guard(retireLock_);
+    Retired retired = { epoch_.load(), object, destroy };
+    retired_.push_back(retired);
+    if (++sinceCollect_ >= collectInterval) {
+        sinceCollect_ = 0;
+        tryAdvance();
+        collect();
+    }
+}
+
+/**
+* Tells managers apart even when one is built where another used to be.
+*/
+inline std::uint64_t EpochManager::nextId()
+{
+    static std::atomic<std::uint64_t> next(1);
+    return next.fetch_add(1);
+}
+
+/**
+* Finds or makes the calling thread's record. The last one looked up is
+* cached per thread; records are never removed, so the list can be
+* walked and pushed onto without a lock.
+*/
+inline EpochManager::Record* EpochManager::record()
+{
+    struct Cache
+    {
+        std::uint64_t id;
+        Record* record;
+    };
+    static thread_local Cache cache = { 0, nullptr };
+    if (cache.id == id_) {
+        return cache.record;
+    }
+
+    std::thread::id self = std::this_thread::get_id();
+    Record* record = records_.load();
+    while (record != nullptr && record->owner != self) {
+        record = record->next;
+    }
+    if (record == nullptr) {
+        record = new Record;
+        record->state.store(0);
+        record->owner = self;
+        record->depth = 0;
+        record->next = records_.load();
+        while (!records_.compare_exchange_weak(record->next, record)) {
+        }
+    }
+    cache.id = id_;
+    cache.record = record;
+    return record;
+}
+
+/**
+* Moves the epoch on if every thread inside a Guard has seen the current
+* one. Called with retireLock_ held, so only one thread advances.
+*/
+inline void EpochManager::tryAdvance()
+{
+    std::uint64_t epoch = epoch_.load();
+    for (Record* record = records_.load(); record != nullptr; record = record->next) {
+        std::uint64_t state = record->state.load();
+        if ((state & 1) != 0 && state / 2 != epoch) {
+            return;
+        }
+    }
+    epoch_.store(epoch + 1);
+}
+
+/**
+* Destroys whatever was retired at least two epochs ago. Called with
+* retireLock_ held.
+*/
+inline void EpochManager::collect()
+{
+    std::uint64_t epoch = epoch_.load();
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < retired_.size(); ++i) {
+        if (retired_[i].epoch + 2 <= epoch) {
+            retired_[i].destroy(retired_[i].object);
+        } else {
+            retired_[kept++] = retired_[i];
+        }
+    }
+    retired_.resize(kept);
+}
+
+#endif
@@ -0,0 +1,548 @@
+#ifndef EYTZINGER_H
+#define EYTZINGER_H
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if defined(__AVX2__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/**
+* Prefetches the 64 bytes at base + 64 * index. In an Eytzinger array of
+* keys starting on a cache line, that line holds all the descendants of
+* node index as many levels down as fit in one line. The address may lie
+* past the array, which is harmless for a prefetch but must not be formed
+* as a pointer into it.
+*/
+inline void eytzingerPrefetch(const void* base, std::size_t index)
+{
+    __builtin_prefetch(reinterpret_cast<const void*>(reinterpret_cast<std::uintptr_t>(base) + 64 * index));
+}
+
+#if defined(__AVX2__) && defined(__x86_64__)
+/**
+* Loads, gathers and compares for AVX2 searches of 64-bit keys, four to a
+* register. Unsigned keys have their top bit flipped so that the signed
+* compare orders them correctly; doubles travel in integer registers.
+*/
+template<bool Float, bool Signed>
+struct EytzingerAvx2Keys64
+{
+    static __m256i flip()
+    {
+        return Signed ? _mm256_setzero_si256() : _mm256_set1_epi64x(LLONG_MIN);
+    }
+    static __m256i load(const void* keys)
+    {
+        return _mm256_xor_si256(_mm256_loadu_si256(static_cast<const __m256i*>(keys)), flip());
+    }
+    static __m256i gather(const void* base, __m256i index, __m256i live)
+    {
+        return _mm256_xor_si256(_mm256_mask_i64gather_epi64(_mm256_setzero_si256(),
+                                                            static_cast<const long long*>(base),
+                                                            index, live, 8), flip());
+    }
+    static __m256i less(__m256i keys, __m256i queries)
+    {
+        return _mm256_cmpgt_epi64(queries, keys);
+    }
+};
+
+template<>
+struct EytzingerAvx2Keys64<true, true>
+{
+    static __m256i load(const void* keys)
+    {
+        return _mm256_castpd_si256(_mm256_loadu_pd(static_cast<const double*>(keys)));
+    }
+    static __m256i gather(const void* base, __m256i index, __m256i live)
+    {
+        return _mm256_castpd_si256(_mm256_mask_i64gather_pd(_mm256_setzero_pd(),
+                                                            static_cast<const double*>(base),
+                                                            index, _mm256_castsi256_pd(live), 8));
+    }
+    static __m256i less(__m256i keys, __m256i queries)
+    {
+        return _mm256_castpd_si256(_mm256_cmp_pd(_mm256_castsi256_pd(keys),
+                                                 _mm256_castsi256_pd(queries), _CMP_LT_OQ));
+    }
+};
+
+/**
+* The same for 32-bit keys, eight to a register.
+*/
+template<bool Float, bool Signed>
+struct EytzingerAvx2Keys32
+{
+    static __m256i flip()
+    {
+        return Signed ? _mm256_setzero_si256() : _mm256_set1_epi32(INT_MIN);
+    }
+    static __m256i load(const void* keys)
+    {
+        return _mm256_xor_si256(_mm256_loadu_si256(static_cast<const __m256i*>(keys)), flip());
+    }
+    static __m256i gather(const void* base, __m256i index, __m256i live)
+    {
+        return _mm256_xor_si256(_mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+                                                            static_cast<const int*>(base),
+                                                            index, live, 4), flip());
+    }
+    static __m256i less(__m256i keys, __m256i queries)
+    {
+        return _mm256_cmpgt_epi32(queries, keys);
+    }
+};
+
+template<>
+struct EytzingerAvx2Keys32<true, true>
+{
+    static __m256i load(const void* keys)
+    {
+        return _mm256_castps_si256(_mm256_loadu_ps(static_cast<const float*>(keys)));
+    }
+    static __m256i gather(const void* base, __m256i index, __m256i live)
+    {
+        return _mm256_castps_si256(_mm256_mask_i32gather_ps(_mm256_setzero_ps(),
+                                                            static_cast<const float*>(base),
+                                                            index, _mm256_castsi256_ps(live), 4));
+    }
+    static __m256i less(__m256i keys, __m256i queries)
+    {
+        return _mm256_castps_si256(_mm256_cmp_ps(_mm256_castsi256_ps(keys),
+                                                 _mm256_castsi256_ps(queries), _CMP_LT_OQ));
+    }
+};
+#endif
+
+/**
+* Runs eight searches of an Eytzinger array side by side with AVX2 where
+* the key type allows it. available is false for other key types, for
+* builds without AVX2 and for arrays too big for the lane's indices;
+* EytzingerArray then interleaves eight scalar searches instead.
+*/
+template<typename Key, bool Float = std::is_floating_point<Key>::value,
+         bool Signed = std::is_signed<Key>::value, std::size_t Size = sizeof(Key)>
+struct EytzingerSimd
+{
+    static bool available(std::size_t)
+    {
+        return false;
+    }
+    static void descend(const Key*, std::size_t, int, const Key*, std::size_t*)
+    {
+
+    }
+};
+
+#if defined(__AVX2__) && defined(__x86_64__)
+template<typename Key, bool Float, bool Signed>
+struct EytzingerSimd<Key, Float, Signed, 8>
+{
+    typedef EytzingerAvx2Keys64<Float, Signed> Keys;
+
+    static bool available(std::size_t)
+    {
+        return true;
+    }
+
+    /**
+    * Two registers of four searches each, so that two gathers are in
+    * flight at once. Every search takes fullLevels steps, then one more
+    * in the lanes still inside the array. Gathers do not run ahead the
+    * way scalar loads do, so the lanes' lines further down are
+    * prefetched by hand as in the scalar walk.
+    */
+    static void descend(const Key* base, std::size_t count, int fullLevels,
+                        const Key* queries, std::size_t* index)
+    {
+        const __m256i all = _mm256_set1_epi64x(-1);
+        const __m256i limit = _mm256_set1_epi64x(static_cast<long long>(count) + 1);
+        __m256i query[2] = { Keys::load(queries), Keys::load(queries + 4) };
+        __m256i at[2] = { _mm256_set1_epi64x(1), _mm256_set1_epi64x(1) };
+        for (int level = 0; level < fullLevels; ++level) {
+            for (int half = 0; half < 2; ++half) {
+                long long ahead[4];
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(ahead), at[half]);
+                for (int lane = 0; lane < 4; ++lane) {
+                    eytzingerPrefetch(base, static_cast<std::size_t>(ahead[lane]));
+                }
+                __m256i less = Keys::less(Keys::gather(base, at[half], all), query[half]);
+                at[half] = _mm256_sub_epi64(_mm256_add_epi64(at[half], at[half]), less);
+            }
+        }
+        for (int half = 0; half < 2; ++half) {
+            __m256i live = _mm256_cmpgt_epi64(limit, at[half]);
+            __m256i less = _mm256_and_si256(Keys::less(Keys::gather(base, at[half], live), query[half]), live);
+            at[half] = _mm256_sub_epi64(_mm256_add_epi64(at[half], _mm256_and_si256(at[half], live)), less);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(index + 4 * half), at[half]);
+        }
+    }
+};
+
+template<typename Key, bool Float, bool Signed>
+struct EytzingerSimd<Key, Float, Signed, 4>
+{
+    typedef EytzingerAvx2Keys32<Float, Signed> Keys;
+
+    /**
+    * Indices are 32-bit lanes too, which caps the array at 2^30 keys.
+    */
+    static bool available(std::size_t count)
+    {
+        return count < (std::size_t(1) << 30);
+    }
+
+    static void descend(const Key* base, std::size_t count, int fullLevels,
+                        const Key* queries, std::size_t* index)
+    {
+        const __m256i all = _mm256_set1_epi32(-1);
+        const __m256i limit = _mm256_set1_epi32(static_cast<int>(count) + 1);
+        __m256i query = Keys::load(queries);
+        __m256i at = _mm256_set1_epi32(1);
+        int ahead[8];
+        for (int level = 0; level < fullLevels; ++level) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(ahead), at);
+            for (int lane = 0; lane < 8; ++lane) {
+                eytzingerPrefetch(base, static_cast<std::size_t>(ahead[lane]));
+            }
+            __m256i less = Keys::less(Keys::gather(base, at, all), query);
+            at = _mm256_sub_epi32(_mm256_add_epi32(at, at), less);
+        }
+        __m256i live = _mm256_cmpgt_epi32(limit, at);
+        __m256i less = _mm256_and_si256(Keys::less(Keys::gather(base, at, live), query), live);
+        at = _mm256_sub_epi32(_mm256_add_epi32(at, _mm256_and_si256(at, live)), less);
+        int lanes[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), at);
+        for (int lane = 0; lane < 8; ++lane) {
+            index[lane] = static_cast<std::size_t>(lanes[lane]);
+        }
+    }
+};
+#endif
+
+/**
+* A read-only copy of a map with arithmetic keys, flattened into
+* Eytzinger (breadth-first) order: the root at index 1 and the children
+* of i at 2i and 2i + 1. Values sit in a parallel array. Made by
+* toEytzinger().
+*
+* A search is a branch-free walk down the array. The descendants of a
+* node a few levels down share one cache line, so fetching that line one
+* step ahead keeps several levels of the walk in flight at once. The
+* batch find() runs eight searches in lock step, with AVX2 gathers and
+* compares where the build allows and plain interleaved loads otherwise,
+* so that the eight cache misses of each level overlap.
+*
+* Value must be default constructible.
+*/
+template <typename Key, typename Value>
+class EytzingerArray
+{
+    static_assert(std::is_arithmetic<Key>::value, "EytzingerArray needs an arithmetic key type");
+
+public:
+    EytzingerArray();
+    template<typename InputIt>
+    EytzingerArray(InputIt first, std::size_t count);
+    EytzingerArray(const EytzingerArray& other);
+    EytzingerArray(EytzingerArray&& other);
+    EytzingerArray& operator=(EytzingerArray other);
+
+    void swap(EytzingerArray& other);
+    bool empty() const;
+    std::size_t size() const;
+    bool vectorized() const;
+
+    const Value* find(const Key& key) const;
+    void find(const Key* keys, std::size_t count, const Value** found) const;
+
+protected:
+    // searches run side by side in a batch
+    static const std::size_t groupSize = 8;
+    // keys per cache line
+    static const std::size_t lineKeys = 64 / sizeof(Key);
+
+    const Key* base() const;
+    Key* base();
+    void align();
+    template<typename InputIt>
+    void fill(InputIt& item, std::size_t index);
+    std::size_t descend(const Key& key) const;
+    void descendGroup(const Key* keys, std::size_t* index) const;
+    const Value* match(std::size_t index, const Key& key) const;
+
+    // base() is keys_ moved on to a cache line boundary, so keys_ holds
+    // that much slack on top of the size_ + 1 slots used
+    std::vector<Key> keys_;
+    std::size_t offset_;
+    std::vector<Value> values_;
+    std::size_t size_;
+    // levels filled all the way across, at most one short of the height
+    int fullLevels_;
+};
+
+/*
+-----------------------------------------------------
+Begin implementations for the EytzingerArray class.
+-----------------------------------------------------
+*/
+
+template<class Key, class Value>
+EytzingerArray<Key, Value>::EytzingerArray() :
+    keys_(1 + lineKeys),
+    offset_(0),
+    values_(1),
+    size_(0),
+    fullLevels_(0)
+{
+    align();
+}
+
+/**
+* Reads count items, sorted by key with no key twice, starting at first.
+*/
+template<class Key, class Value>
+template<typename InputIt>
+EytzingerArray<Key, Value>::EytzingerArray(InputIt first, std::size_t count) :
+    keys_(count + 1 + lineKeys),
+    offset_(0),
+    values_(count + 1),
+    size_(count),
+    fullLevels_(0)
+{
+    align();
+    while ((count + 1) >> (fullLevels_ + 1) != 0) {
+        fullLevels_++;
+    }
+    fill(first, 1);
+}
+
+/**
+* Copies into a buffer of its own, which may need a different offset to
+* reach a line boundary.
+*/
+template<class Key, class Value>
+EytzingerArray<Key, Value>::EytzingerArray(const EytzingerArray& other) :
+    keys_(other.keys_.size()),
+    offset_(0),
+    values_(other.values_),
+    size_(other.size_),
+    fullLevels_(other.fullLevels_)
+{
+    align();
+    std::copy(other.base(), other.base() + size_ + 1, base());
+}
+
+template<class Key, class Value>
+EytzingerArray<Key, Value>::EytzingerArray(EytzingerArray&& other) :
+    keys_(std::move(other.keys_)),
+    offset_(other.offset_),
+    values_(std::move(other.values_)),
+    size_(other.size_),
+    fullLevels_(other.fullLevels_)
+{
+    other.keys_.assign(1 + lineKeys, Key());
+    other.values_.assign(1, Value());
+    other.size_ = 0;
+    other.fullLevels_ = 0;
+    other.align();
+}
+
+template<class Key, class Value>
+EytzingerArray<Key, Value>& EytzingerArray<Key, Value>::operator=(EytzingerArray other)
+{
+    swap(other);
+    return *this;
+}
+
+template<class Key, class Value>
+void EytzingerArray<Key, Value>::swap(EytzingerArray& other)
+{
+    keys_.swap(other.keys_);
+    std::swap(offset_, other.offset_);
+    values_.swap(other.values_);
+    std::swap(size_, other.size_);
+    std::swap(fullLevels_, other.fullLevels_);
+}
+
+template<class Key, class Value>
+bool EytzingerArray<Key, Value>::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value>
+std::size_t EytzingerArray<Key, Value>::size() const
+{
+    return size_;
+}
+
+/**
+* Whether the batch find() uses SIMD for this key type and size.
+*/
+template<class Key, class Value>
+bool EytzingerArray<Key, Value>::vectorized() const
+{
+    return EytzingerSimd<Key>::available(size_);
+}
+
+/**
+* The value stored under key, or NULL if there is none.
+*/
+template<class Key, class Value>
+const Value* EytzingerArray<Key, Value>::find(const Key& key) const
+{
+    return match(descend(key), key);
+}
+
+/**
+* Looks up count keys at once, setting found[i] as find(keys[i]) would.
+*/
+template<class Key, class Value>
+void EytzingerArray<Key, Value>::find(const Key* keys, std::size_t count, const Value** found) const
+{
+    std::size_t index[groupSize];
+    std::size_t i = 0;
+    for (; i + groupSize <= count; i += groupSize) {
+        descendGroup(keys + i, index);
+        for (std::size_t lane = 0; lane < groupSize; ++lane) {
+            found[i + lane] = match(index[lane], keys[i + lane]);
+        }
+    }
+    for (; i < count; ++i) {
+        found[i] = find(keys[i]);
+    }
+}
+
+template<class Key, class Value>
+const Key* EytzingerArray<Key, Value>::base() const
+{
+    return keys_.data() + offset_;
+}
+
+template<class Key, class Value>
+Key* EytzingerArray<Key, Value>::base()
+{
+    return keys_.data() + offset_;
+}
+
+/**
+* Picks offset_ so that base() starts a cache line.
+*/
+template<class Key, class Value>
+void EytzingerArray<Key, Value>::align()
+{
+    std::size_t misalign = reinterpret_cast<std::uintptr_t>(keys_.data()) % 64;
+    offset_ = misalign == 0 ? 0 : (64 - misalign) / sizeof(Key);
+}
+
+/**
+* Copies items into the subtree under index in key order, the same walk
+* that filled it from the tree's begin().
+*/
+template<class Key, class Value>
+template<typename InputIt>
+void EytzingerArray<Key, Value>::fill(InputIt& item, std::size_t index)
+{
+    if (index > size_) {
+        return;
+    }
+    fill(item, 2 * index);
+    base()[index] = item->first;
+    values_[index] = item->second;
+    ++item;
+    fill(item, 2 * index + 1);
+}
+
+/**
+* Walks down from the root without branching on the keys and returns the
+* index just below the leaf reached. The walk goes right whenever the
+* node is less than key, so the lower bound is the last node it turned
+* left at; match() recovers it.
+*/
+template<class Key, class Value>
+std::size_t EytzingerArray<Key, Value>::descend(const Key& key) const
+{
+    const Key* keys = base();
+    std::size_t index = 1;
+    for (int level = 0; level < fullLevels_; ++level) {
+        eytzingerPrefetch(keys, index);
+        index = 2 * index + (keys[index] < key);
+    }
+    if (index <= size_) {
+        index = 2 * index + (keys[index] < key);
+    }
+    return index;
+}
+
+/**
+* descend() for groupSize keys at once.
+*/
+template<class Key, class Value>
+void EytzingerArray<Key, Value>::descendGroup(const Key* keys, std::size_t* index) const
+{
+    if (EytzingerSimd<Key>::available(size_)) {
+        EytzingerSimd<Key>::descend(base(), size_, fullLevels_, keys, index);
+        return;
+    }
+    const Key* nodes = base();
+    for (std::size_t lane = 0; lane < groupSize; ++lane) {
+        index[lane] = 1;
+    }
+    for (int level = 0; level < fullLevels_; ++level) {
+        for (std::size_t lane = 0; lane < groupSize; ++lane) {
+            eytzingerPrefetch(nodes, index[lane]);
+            index[lane] = 2 * index[lane] + (nodes[index[lane]] < keys[lane]);
+        }
+    }
+    for (std::size_t lane = 0; lane < groupSize; ++lane) {
+        if (index[lane] <= size_) {
+            index[lane] = 2 * index[lane] + (nodes[index[lane]] < keys[lane]);
+        }
+    }
+}
+
+/**
+* Drops the trailing right turns and the left turn before them from a
+* finished walk, which leaves the lower bound (0 if every key was less),
+* and returns its value if it holds key itself.
+*/
+template<class Key, class Value>
+const Value* EytzingerArray<Key, Value>::match(std::size_t index, const Key& key) const
+{
+    index >>= __builtin_ffsll(static_cast<long long>(~index));
+    if (index == 0 || !(base()[index] == key)) {
+        return nullptr;
+    }
+    return &values_[index];
+}
+
+/*
+---------------------------------------------------
+End implementations for the EytzingerArray class.
+---------------------------------------------------
+*/
+
+/**
+* Copies a tree's contents into an EytzingerArray, for trees with
+* arithmetic keys in their natural order. Works with any tree that has
+* size() and iterators walking it in key order, such as BinarySearchTree
+* and AVLTree.
+*/
+template<typename Key, typename Value, typename Compare,
+         template<typename, typename, typename> class Tree>
+EytzingerArray<Key, Value> toEytzinger(const Tree<Key, Value, Compare>& tree)
+{
+    static_assert(std::is_same<Compare, std::less<Key> >::value,
+                  "toEytzinger() needs keys ordered by std::less");
+    return EytzingerArray<Key, Value>(tree.begin(), tree.size());
+}
+
+#endif
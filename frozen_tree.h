@@ -0,0 +1,302 @@
+#ifndef FROZEN_TREE_H
+#define FROZEN_TREE_H
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+/**
+* An immutable map built once from sorted contents, normally by
+* freeze().
+*
+* The items sit in key order in one array, so iterating is a plain scan.
+* Lookups descend a separate perfect binary tree holding just the keys,
+* stored in van Emde Boas order: the top half of the levels is laid out
+* first, then each subtree hanging below it, recursively. A search then
+* stays within a small run of memory for several levels at a time
+* whatever the cache line or page size, instead of missing once per
+* level as it does through heap-allocated nodes.
+*
+* The layout has no links. Where the next key lives is worked out from
+* the path taken so far and three small tables per depth, as in Brodal,
+* Fagerberg and Jacob's "Cache oblivious search trees via binary trees of
+* small height". The search tree is rounded up to 2^h - 1 keys by
+* repeating the largest one, so it costs up to twice the memory of the
+* keys themselves on top of the items.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenTree
+{
+public:
+    typedef std::pair<const Key, Value> value_type;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+    typedef const_iterator iterator;
+
+    FrozenTree();
+    explicit FrozenTree(const Compare& comp);
+    template<typename ForwardIt>
+    FrozenTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+
+    bool empty() const;
+    std::size_t size() const;
+    Compare key_comp() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+
+protected:
+    // deep enough for any tree that fits in memory
+    static const int maxHeight = 64;
+
+    void split(int depth, int levels);
+    std::size_t position(const std::size_t* path, std::size_t index, int depth) const;
+    std::size_t rank(std::size_t index, int depth) const;
+    void place(std::size_t* path, std::size_t index, int depth);
+    template<bool Upper>
+    std::size_t bound(const Key& key) const;
+
+    std::vector<value_type> items_;
+    // the perfect tree of height height_ in van Emde Boas order; node
+    // index (1 for the root, 2i and 2i + 1 for the children of i) at
+    // depth d holds the key of items_[rank(index, d)]
+    std::vector<Key> keys_;
+    int height_;
+    // a node at depth d > 0 roots one of the bottom subtrees, each of
+    // size bottomSize_[d], that hang below a top subtree of size
+    // topSize_[d] whose root is at depth topDepth_[d]
+    std::size_t topSize_[maxHeight];
+    std::size_t bottomSize_[maxHeight];
+    int topDepth_[maxHeight];
+    Compare comp_;
+};
+
+/*
+-------------------------------------------------
+Begin implementations for the FrozenTree class.
+-------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree() :
+    height_(0),
+    comp_()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree(const Compare& comp) :
+    height_(0),
+    comp_(comp)
+{
+
+}
+
+/**
+* Builds the tree from [first, last), which must be sorted by comp with
+* no two keys equal. O(n).
+*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+FrozenTree<Key, Value, Compare>::FrozenTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    items_(first, last),
+    height_(0),
+    comp_(comp)
+{
+    while ((items_.size() >> height_) != 0) {
+        height_++;
+    }
+    if (height_ == 0) {
+        return;
+    }
+    split(0, height_);
+    keys_.assign((std::size_t(1) << height_) - 1, items_.back().first);
+    std::size_t path[maxHeight];
+    path[0] = 0;
+    place(path, 1, 0);
+}
+
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::empty() const
+{
+    return items_.empty();
+}
+
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::size() const
+{
+    return items_.size();
+}
+
+template<class Key, class Value, class Compare>
+Compare FrozenTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::begin() const
+{
+    return items_.begin();
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::end() const
+{
+    return items_.end();
+}
+
+/**
+* Finds the lower bound in the search tree and only then touches items_.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::find(const Key& key) const
+{
+    std::size_t found = bound<false>(key);
+    if (found == items_.size() || comp_(key, items_[found].first)) {
+        return items_.end();
+    }
+    return items_.begin() + found;
+}
+
+/**
+* The first item whose key is not less than key.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return items_.begin() + bound<false>(key);
+}
+
+/**
+* The first item whose key is greater than key.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return items_.begin() + bound<true>(key);
+}
+
+/**
+* Fills in the tables for a subtree of the given number of levels whose
+* root is at depth: its top levels / 2 levels come first in the layout,
+* then the subtrees below them, each laid out the same way.
+*/
+template<class Key, class Value, class Compare>
+void FrozenTree<Key, Value, Compare>::split(int depth, int levels)
+{
+    if (levels <= 1) {
+        return;
+    }
+    int top = levels / 2;
+    int bottom = levels - top;
+    topDepth_[depth + top] = depth;
+    topSize_[depth + top] = (std::size_t(1) << top) - 1;
+    bottomSize_[depth + top] = (std::size_t(1) << bottom) - 1;
+    split(depth, top);
+    split(depth + top, bottom);
+}
+
+/**
+* Where node index at depth > 0 sits in keys_, given where its ancestors
+* sit in path. The low bits of index say which of the bottom subtrees
+* below its top subtree it roots.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::position(const std::size_t* path,
+                                                      std::size_t index, int depth) const
+{
+    return path[topDepth_[depth]] + topSize_[depth] + (index & topSize_[depth]) * bottomSize_[depth];
+}
+
+/**
+* In-order rank of node index at depth; ranks from size() on belong to
+* the padding.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::rank(std::size_t index, int depth) const
+{
+    std::size_t offset = index - (std::size_t(1) << depth);
+    return ((2 * offset + 1) << (height_ - 1 - depth)) - 1;
+}
+
+/**
+* Copies the keys of node index and everything below it into keys_.
+* path[depth] must already hold the node's position.
+*/
+template<class Key, class Value, class Compare>
+void FrozenTree<Key, Value, Compare>::place(std::size_t* path, std::size_t index, int depth)
+{
+    std::size_t itemRank = rank(index, depth);
+    if (itemRank < items_.size()) {
+        keys_[path[depth]] = items_[itemRank].first;
+    }
+    if (depth + 1 == height_) {
+        return;
+    }
+    for (std::size_t child = 2 * index; child <= 2 * index + 1; ++child) {
+        path[depth + 1] = position(path, child, depth + 1);
+        place(path, child, depth + 1);
+    }
+}
+
+/**
+* Rank of the first item not less than key (greater than key if Upper),
+* or size() if there is none: the last node the search turned left at.
+* The padding repeats the largest key, so the answer is never a padding
+* node unless every item is too small.
+*/
+template<class Key, class Value, class Compare>
+template<bool Upper>
+std::size_t FrozenTree<Key, Value, Compare>::bound(const Key& key) const
+{
+    std::size_t path[maxHeight];
+    std::size_t found = items_.size();
+    std::size_t index = 1;
+    path[0] = 0;
+    for (int depth = 0; depth < height_; ++depth) {
+        if (depth > 0) {
+            path[depth] = position(path, index, depth);
+        }
+        const Key& current = keys_[path[depth]];
+        bool right = Upper ? !comp_(key, current) : comp_(current, key);
+        if (right) {
+            index = 2 * index + 1;
+        }
+        else {
+            found = rank(index, depth);
+            index = 2 * index;
+        }
+    }
+    return found;
+}
+
+/*
+-----------------------------------------------
+End implementations for the FrozenTree class.
+-----------------------------------------------
+*/
+
+/**
+* Copies a tree's contents into a FrozenTree with the same ordering.
+* Later changes to the tree do not show up in it. Works with any tree
+* whose iterators walk it in key order, such as BinarySearchTree and
+* AVLTree.
+*/
+template<typename Key, typename Value, typename Compare,
+         template<typename, typename, typename> class Tree>
+FrozenTree<Key, Value, Compare> freeze(const Tree<Key, Value, Compare>& tree)
+{
+    return FrozenTree<Key, Value, Compare>(tree.begin(), tree.end(), tree.key_comp());
+}
+
+#endif
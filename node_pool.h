@@ -0,0 +1,304 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+/**
+ * A slab allocator for fixed-size tree nodes.
+ *
+ * Blocks are carved out of large slabs and removed blocks go on a free
+ * list, so inserts after a remove reuse memory instead of calling malloc.
+ * release() hands every slab back at once, which lets a tree clear itself
+ * without visiting each node.
+ *
+ * Trees that hand nodes to each other (AVLTree::split() and join()) share
+ * one set of slabs, which is freed once no pool holds it any more. A pool
+ * that lets go of a shared set first gives its free blocks back to it,
+ * and the other pools take those before carving new slabs, so trees that
+ * are split off and dropped over and over do not pile up dead blocks.
+ * Each pool's own free list is touched by its tree alone; the shared set
+ * has a lock, taken only when a pool runs dry or lets go.
+ *
+ * Define BST_NO_NODE_POOL to fall back to one global operator new per
+ * node (useful for comparing the two, or for running under valgrind).
+ */
+class NodePool
+{
+public:
+#ifndef BST_NO_NODE_POOL
+    static const bool bulkRelease = true;
+#else
+    static const bool bulkRelease = false;
+#endif
+
+    explicit NodePool(std::size_t blockSize);
+    ~NodePool();
+
+    void* allocate();
+    void deallocate(void* block);
+    bool exclusive();
+    void release();
+    void share(NodePool& other);
+
+private:
+    NodePool(const NodePool&);
+    NodePool& operator=(const NodePool&);
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    // The slabs of every pool that has traded nodes with this one, and
+    // the blocks handed back by those that let go. A set merged into
+    // another one points there, and pools move on when they next look.
+    struct SlabSet
+    {
+        SlabSet() : spare(nullptr) {}
+        ~SlabSet();
+
+        std::mutex lock;
+        std::vector<char*> slabs;
+        FreeBlock* spare;
+        std::shared_ptr<SlabSet> mergedInto;
+    };
+
+    std::unique_lock<std::mutex> lockSlabs();
+    void refill();
+    void addSlab();
+
+    std::size_t blockSize_;
+    std::size_t slabBlocks_;
+    FreeBlock* freeList_;
+    char* cursor_;
+    std::size_t cursorBlocks_;
+    std::shared_ptr<SlabSet> slabs_;
+};
+
+inline NodePool::SlabSet::~SlabSet()
+{
+    for (std::size_t i = 0; i < slabs.size(); ++i) {
+        ::operator delete(slabs[i]);
+    }
+}
+
+/**
+* Rounds the block size up so that every block stays suitably aligned and
+* can hold a free list link.
+*/
+inline NodePool::NodePool(std::size_t blockSize) :
+    blockSize_(blockSize),
+    slabBlocks_(32),
+    freeList_(nullptr),
+    cursor_(nullptr),
+    cursorBlocks_(0)
+{
+    const std::size_t align = alignof(std::max_align_t);
+    if (blockSize_ < sizeof(FreeBlock)) {
+        blockSize_ = sizeof(FreeBlock);
+    }
+    blockSize_ = (blockSize_ + align - 1) / align * align;
+}
+
+inline NodePool::~NodePool()
+{
+    release();
+}
+
+/**
+* Returns uninitialized memory for one node, preferring recycled blocks.
+*/
+inline void* NodePool::allocate()
+{
+#ifdef BST_NO_NODE_POOL
+    return ::operator new(blockSize_);
+#else
+    if (freeList_ == nullptr && cursorBlocks_ == 0) {
+        refill();
+    }
+    if (freeList_ != nullptr) {
+        FreeBlock* block = freeList_;
+        freeList_ = block->next;
+        return block;
+    }
+    void* block = cursor_;
+    cursor_ += blockSize_;
+    cursorBlocks_--;
+    return block;
+#endif
+}
+
+/**
+* Puts a block back on the free list. The node living there must
+* already have been destroyed.
+*/
+inline void NodePool::deallocate(void* block)
+{
+#ifdef BST_NO_NODE_POOL
+    ::operator delete(block);
+#else
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = freeList_;
+    freeList_ = freed;
+#endif
+}
+
+/**
+* Tells whether no other pool shares our slabs, in which case release()
+* may drop them with nodes still inside. Otherwise the nodes have to be
+* deallocated one by one first, so that their blocks go back to the set.
+*/
+inline bool NodePool::exclusive()
+{
+    if (!slabs_) {
+        return true;
+    }
+    std::unique_lock<std::mutex> guard = lockSlabs();
+    return slabs_.use_count() == 1;
+}
+
+/**
+* Lets go of every slab. Any nodes still inside are simply dropped, so
+* callers must destroy them first unless their destructors are trivial
+* and the pool is exclusive(). Slabs shared with another pool live on
+* until that pool lets go too, and get our free blocks for it to reuse.
+* Does nothing when BST_NO_NODE_POOL is defined.
+*/
+inline void NodePool::release()
+{
+    if (slabs_) {
+        std::unique_lock<std::mutex> guard = lockSlabs();
+        if (slabs_.use_count() > 1) {
+            for (; cursorBlocks_ > 0; cursorBlocks_--, cursor_ += blockSize_) {
+                deallocate(cursor_);
+            }
+            while (freeList_ != nullptr) {
+                FreeBlock* block = freeList_;
+                freeList_ = block->next;
+                block->next = slabs_->spare;
+                slabs_->spare = block;
+            }
+        }
+        guard.unlock();
+        slabs_.reset();
+    }
+    freeList_ = nullptr;
+    cursor_ = nullptr;
+    cursorBlocks_ = 0;
+    slabBlocks_ = 32;
+}
+
+/**
+* Puts this pool and other on one set of slabs, so that nodes moved
+* between their trees stay valid for as long as either pool holds on.
+* The smaller set is merged into the bigger one.
+*/
+inline void NodePool::share(NodePool& other)
+{
+    if (&other == this || !other.slabs_) {
+        return;
+    }
+    if (!slabs_) {
+        other.lockSlabs();
+        slabs_ = other.slabs_;
+        return;
+    }
+    for (;;) {
+        // catch up with earlier merges before comparing
+        lockSlabs();
+        other.lockSlabs();
+        if (slabs_ == other.slabs_) {
+            return;
+        }
+        std::unique_lock<std::mutex> ours(slabs_->lock, std::defer_lock);
+        std::unique_lock<std::mutex> theirs(other.slabs_->lock, std::defer_lock);
+        std::lock(ours, theirs);
+        if (slabs_->mergedInto || other.slabs_->mergedInto) {
+            // another thread merged one of them meanwhile
+            continue;
+        }
+        std::shared_ptr<SlabSet> into = slabs_;
+        std::shared_ptr<SlabSet> from = other.slabs_;
+        if (into->slabs.size() < from->slabs.size()) {
+            std::swap(into, from);
+        }
+        into->slabs.insert(into->slabs.end(), from->slabs.begin(), from->slabs.end());
+        from->slabs.clear();
+        while (from->spare != nullptr) {
+            FreeBlock* block = from->spare;
+            from->spare = block->next;
+            block->next = into->spare;
+            into->spare = block;
+        }
+        from->mergedInto = into;
+        slabs_ = into;
+        other.slabs_ = into;
+        // from may go away with the last reference, so unlock it first
+        ours.unlock();
+        theirs.unlock();
+        return;
+    }
+}
+
+/**
+* Locks our set of slabs, following it into whatever set it has been
+* merged with first.
+*/
+inline std::unique_lock<std::mutex> NodePool::lockSlabs()
+{
+    std::unique_lock<std::mutex> guard(slabs_->lock);
+    while (slabs_->mergedInto) {
+        std::shared_ptr<SlabSet> next = slabs_->mergedInto;
+        guard.unlock();
+        slabs_ = next;
+        guard = std::unique_lock<std::mutex>(slabs_->lock);
+    }
+    return guard;
+}
+
+/**
+* Called once our free list and slab are used up. Takes whatever blocks
+* other pools on the same slabs handed back, or else a new slab.
+*/
+inline void NodePool::refill()
+{
+    if (!slabs_) {
+        slabs_ = std::make_shared<SlabSet>();
+    }
+    std::unique_lock<std::mutex> guard = lockSlabs();
+    if (slabs_->spare != nullptr) {
+        freeList_ = slabs_->spare;
+        slabs_->spare = nullptr;
+        return;
+    }
+    addSlab();
+}
+
+/**
+* Grabs a new slab, doubling the slab size each time up to a cap so that
+* small trees stay small and big trees make few calls to the heap. The
+* caller holds the lock on our set.
+*/
+inline void NodePool::addSlab()
+{
+    cursor_ = static_cast<char*>(::operator new(blockSize_ * slabBlocks_));
+    try {
+        slabs_->slabs.push_back(cursor_);
+    }
+    catch (...) {
+        ::operator delete(cursor_);
+        cursor_ = nullptr;
+        throw;
+    }
+    cursorBlocks_ = slabBlocks_;
+    if (slabBlocks_ < 4096) {
+        slabBlocks_ *= 2;
+    }
+}
+
+#endif
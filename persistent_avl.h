@@ -0,0 +1,672 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+/**
+* A node for a PersistentAVLTree. There is no parent link, since a node
+* may sit in many versions of the tree at once under different parents.
+* refs counts the parents and trees pointing at it; a node is only
+* changed in place while refs is 1.
+*/
+template <typename Key, typename Value>
+struct PersistentNode
+{
+    PersistentNode(const std::pair<const Key, Value>& item);
+    PersistentNode(const PersistentNode& other);
+
+    std::pair<const Key, Value> item;
+    PersistentNode* left;
+    PersistentNode* right;
+    std::atomic<unsigned> refs;
+    int height;
+};
+
+template<typename Key, typename Value>
+PersistentNode<Key, Value>::PersistentNode(const std::pair<const Key, Value>& item) :
+    item(item),
+    left(nullptr),
+    right(nullptr),
+    refs(1),
+    height(1)
+{
+
+}
+
+/**
+* Copies a shared node for path copying; the copy takes a reference to
+* each of the children instead of copying them.
+*/
+template<typename Key, typename Value>
+PersistentNode<Key, Value>::PersistentNode(const PersistentNode& other) :
+    item(other.item),
+    left(other.left),
+    right(other.right),
+    refs(1),
+    height(other.height)
+{
+    if (left != nullptr) {
+        left->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (right != nullptr) {
+        right->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+* An AVL tree whose old versions stay intact. insert() and remove() copy
+* only the O(log n) nodes on the path to the key and share the rest with
+* every earlier version, so snapshot() (or any copy) is O(1) and stays
+* readable and iterable however the tree changes afterwards. A path that
+* no snapshot shares is updated in place, so writes between snapshots
+* cost about what they do in AVLTree.
+*
+* Without parent links, iterators keep the path from the root on a stack.
+* The contents cannot be changed through them. Reference counts are
+* atomic, so a snapshot may be read and dropped on another thread while
+* this tree keeps changing; a single tree object is not thread safe.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class PersistentAVLTree
+{
+public:
+    PersistentAVLTree();
+    explicit PersistentAVLTree(const Compare& comp);
+    PersistentAVLTree(const PersistentAVLTree& other);
+    PersistentAVLTree(PersistentAVLTree&& other);
+    PersistentAVLTree& operator=(PersistentAVLTree other);
+    ~PersistentAVLTree();
+
+    PersistentAVLTree snapshot() const;
+    void swap(PersistentAVLTree& other);
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool isBalanced() const;
+    bool empty() const;
+    std::size_t size() const;
+
+    /**
+    * A bidirectional iterator over the contents in key order that holds
+    * the path from the root to the current node.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class PersistentAVLTree<Key, Value, Compare>;
+        explicit const_iterator(const PersistentNode<Key, Value>* root);
+        void descend(const PersistentNode<Key, Value>* node, bool leftmost);
+
+        const PersistentNode<Key, Value>* root_;
+        std::vector<const PersistentNode<Key, Value>*> path_;
+    };
+    typedef const_iterator iterator;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+
+protected:
+    typedef PersistentNode<Key, Value> Node;
+
+    static int height(const Node* node);
+    static void fixHeight(Node* node);
+    static void release(Node* node);
+    static Node* own(Node* node);
+    static Node* rotateLeft(Node* node);
+    static Node* rotateRight(Node* node);
+    static Node* balance(Node* node);
+    Node* insertNode(Node* node, const std::pair<const Key, Value>& keyValuePair, bool& added);
+    Node* removeNode(Node* node, const Key& key);
+    static Node* removeSmallest(Node* node, Node*& smallest);
+    static int checkHeight(const Node* node);
+
+    Node* root_;
+    std::size_t size_;
+    Compare comp_;
+};
+
+/*
+----------------------------------------------------------------------
+Begin implementations for the PersistentAVLTree::const_iterator class.
+----------------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::const_iterator::const_iterator() :
+    root_(nullptr)
+{
+
+}
+
+/**
+* An end iterator for the version rooted at root.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::const_iterator::const_iterator(const PersistentNode<Key, Value>* root) :
+    root_(root)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator::reference
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return path_.back()->item;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator::pointer
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &path_.back()->item;
+}
+
+/**
+* Iterators are equal when they point at the same node; all end
+* iterators compare equal.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    const Node* current = path_.empty() ? nullptr : path_.back();
+    const Node* other = rhs.path_.empty() ? nullptr : rhs.path_.back();
+    return current == other;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Pushes node and then its leftmost (or rightmost) descendants.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::const_iterator::descend(const PersistentNode<Key, Value>* node,
+                                                                     bool leftmost)
+{
+    while (node != nullptr) {
+        path_.push_back(node);
+        node = leftmost ? node->left : node->right;
+    }
+}
+
+/**
+* Steps to the next key: down to the smallest key on the right if there
+* is a right subtree, otherwise up past every ancestor we were right of.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator&
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    const Node* node = path_.back();
+    if (node->right != nullptr) {
+        descend(node->right, true);
+        return *this;
+    }
+    path_.pop_back();
+    while (!path_.empty() && path_.back()->right == node) {
+        node = path_.back();
+        path_.pop_back();
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator before(*this);
+    ++(*this);
+    return before;
+}
+
+/**
+* The mirror image of operator++; decrementing end() goes to the largest
+* key.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator&
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    if (path_.empty()) {
+        descend(root_, false);
+        return *this;
+    }
+    const Node* node = path_.back();
+    if (node->left != nullptr) {
+        descend(node->left, false);
+        return *this;
+    }
+    path_.pop_back();
+    while (!path_.empty() && path_.back()->left == node) {
+        node = path_.back();
+        path_.pop_back();
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator before(*this);
+    --(*this);
+    return before;
+}
+
+/*
+--------------------------------------------------------------------
+End implementations for the PersistentAVLTree::const_iterator class.
+--------------------------------------------------------------------
+*/
+
+/*
+--------------------------------------------------------
+Begin implementations for the PersistentAVLTree class.
+--------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree() :
+    root_(nullptr),
+    size_(0),
+    comp_()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const Compare& comp) :
+    root_(nullptr),
+    size_(0),
+    comp_(comp)
+{
+
+}
+
+/**
+* Shares other's nodes; O(1).
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const PersistentAVLTree& other) :
+    root_(other.root_),
+    size_(other.size_),
+    comp_(other.comp_)
+{
+    if (root_ != nullptr) {
+        root_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(PersistentAVLTree&& other) :
+    root_(other.root_),
+    size_(other.size_),
+    comp_(other.comp_)
+{
+    other.root_ = nullptr;
+    other.size_ = 0;
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>&
+PersistentAVLTree<Key, Value, Compare>::operator=(PersistentAVLTree other)
+{
+    swap(other);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree()
+{
+    release(root_);
+}
+
+/**
+* The current contents as a tree of their own, in O(1). Later changes
+* to either tree do not show in the other.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare> PersistentAVLTree<Key, Value, Compare>::snapshot() const
+{
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::swap(PersistentAVLTree& other)
+{
+    std::swap(root_, other.root_);
+    std::swap(size_, other.size_);
+    std::swap(comp_, other.comp_);
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already there.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool added = false;
+    root_ = insertNode(root_, keyValuePair, added);
+    if (added) {
+        size_++;
+    }
+}
+
+/**
+* Removes key if it is there. A missing key copies nothing.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    if (find(key) == end()) {
+        return;
+    }
+    root_ = removeNode(root_, key);
+    size_--;
+}
+
+/**
+* Drops this version; nodes still shared with snapshots stay alive.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear()
+{
+    release(root_);
+    root_ = nullptr;
+    size_ = 0;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkHeight(root_) != -1;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::empty() const
+{
+    return root_ == nullptr;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::begin() const
+{
+    const_iterator it(root_);
+    it.descend(root_, true);
+    return it;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(root_);
+}
+
+/**
+* Returns an iterator to key, or end() if it is not there.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    const_iterator it(root_);
+    const Node* node = root_;
+    while (node != nullptr) {
+        it.path_.push_back(node);
+        if (comp_(key, node->item.first)) {
+            node = node->left;
+        }
+        else if (comp_(node->item.first, key)) {
+            node = node->right;
+        }
+        else {
+            return it;
+        }
+    }
+    return end();
+}
+
+template<class Key, class Value, class Compare>
+int PersistentAVLTree<Key, Value, Compare>::height(const Node* node)
+{
+    return node == nullptr ? 0 : node->height;
+}
+
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::fixHeight(Node* node)
+{
+    node->height = 1 + std::max(height(node->left), height(node->right));
+}
+
+/**
+* Drops one reference to node, freeing it and releasing its children
+* once nothing points at it any more.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::release(Node* node)
+{
+    if (node != nullptr && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        release(node->left);
+        release(node->right);
+        delete node;
+    }
+}
+
+/**
+* Makes node safe to change: returns it as is if nothing else points at
+* it, or else a copy that takes over the caller's reference.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::own(Node* node)
+{
+    if (node->refs.load(std::memory_order_acquire) == 1) {
+        return node;
+    }
+    Node* copy = new Node(*node);
+    release(node);
+    return copy;
+}
+
+/**
+* Rotations work on nodes the caller owns, and own the child that moves
+* up before changing it.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rotateLeft(Node* node)
+{
+    Node* right = own(node->right);
+    node->right = right->left;
+    right->left = node;
+    fixHeight(node);
+    fixHeight(right);
+    return right;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rotateRight(Node* node)
+{
+    Node* left = own(node->left);
+    node->left = left->right;
+    left->right = node;
+    fixHeight(node);
+    fixHeight(left);
+    return left;
+}
+
+/**
+* Fixes the height of an owned node whose subtrees differ by at most two
+* and rotates if they differ by two. Returns the new subtree root.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::balance(Node* node)
+{
+    int diff = height(node->right) - height(node->left);
+    if (diff > 1) {
+        if (height(node->right->left) > height(node->right->right)) {
+            node->right = rotateRight(own(node->right));
+        }
+        return rotateLeft(node);
+    }
+    if (diff < -1) {
+        if (height(node->left->right) > height(node->left->left)) {
+            node->left = rotateLeft(own(node->left));
+        }
+        return rotateRight(node);
+    }
+    fixHeight(node);
+    return node;
+}
+
+/**
+* Inserts below node, taking over the caller's reference to it, and
+* returns the new subtree root with that reference.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::insertNode(Node* node, const std::pair<const Key, Value>& keyValuePair,
+                                                   bool& added)
+{
+    if (node == nullptr) {
+        added = true;
+        return new Node(keyValuePair);
+    }
+    node = own(node);
+    if (comp_(keyValuePair.first, node->item.first)) {
+        node->left = insertNode(node->left, keyValuePair, added);
+    }
+    else if (comp_(node->item.first, keyValuePair.first)) {
+        node->right = insertNode(node->right, keyValuePair, added);
+    }
+    else {
+        node->item.second = keyValuePair.second;
+        return node;
+    }
+    return balance(node);
+}
+
+/**
+* Removes key, which must be present, from below node in the same
+* reference-passing style as insertNode(). A node with two children is
+* replaced by the smallest node of its right subtree.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::removeNode(Node* node, const Key& key)
+{
+    node = own(node);
+    if (comp_(key, node->item.first)) {
+        node->left = removeNode(node->left, key);
+        return balance(node);
+    }
+    if (comp_(node->item.first, key)) {
+        node->right = removeNode(node->right, key);
+        return balance(node);
+    }
+
+    Node* left = node->left;
+    Node* right = node->right;
+    node->left = nullptr;
+    node->right = nullptr;
+    release(node);
+    if (left == nullptr) {
+        return right;
+    }
+    if (right == nullptr) {
+        return left;
+    }
+    Node* smallest;
+    right = removeSmallest(right, smallest);
+    smallest->left = left;
+    smallest->right = right;
+    return balance(smallest);
+}
+
+/**
+* Detaches the smallest node below node and hands it back, owned and
+* without children, in smallest.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::removeSmallest(Node* node, Node*& smallest)
+{
+    node = own(node);
+    if (node->left == nullptr) {
+        Node* right = node->right;
+        node->right = nullptr;
+        smallest = node;
+        return right;
+    }
+    node->left = removeSmallest(node->left, smallest);
+    return balance(node);
+}
+
+/**
+* Height of a subtree, or -1 if some node's stored height is wrong or
+* its children's heights differ by more than one.
+*/
+template<class Key, class Value, class Compare>
+int PersistentAVLTree<Key, Value, Compare>::checkHeight(const Node* node)
+{
+    if (node == nullptr) {
+        return 0;
+    }
+    int left = checkHeight(node->left);
+    int right = checkHeight(node->right);
+    if (left == -1 || right == -1 || left - right > 1 || right - left > 1 ||
+        node->height != 1 + std::max(left, right)) {
+        return -1;
+    }
+    return node->height;
+}
+
+/*
+------------------------------------------------------
+End implementations for the PersistentAVLTree class.
+------------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,656 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+* The first 64 bytes of a snapshot file. The keys follow as one array
+* at keysOffset and the values as another at valuesOffset, both in key
+* order and both starting on a 64-byte boundary. checksum covers the
+* header, read with checksum itself as zero, and every byte after it.
+*/
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t count;
+    uint64_t keysOffset;
+    uint64_t valuesOffset;
+    uint64_t fileSize;
+    uint64_t checksum;
+};
+
+static const char SNAPSHOT_MAGIC[8] = { 'B', 'S', 'T', 'S', 'N', 'A', 'P', '\0' };
+static const uint32_t SNAPSHOT_VERSION = 2;
+// reads back as something else on a machine of the other endianness
+static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304u;
+
+/**
+* A 64-bit checksum built from xxHash64's rounds: four independent lanes
+* of 8-byte words, so verifying a mapped file runs at memory speed. Data
+* may arrive in pieces as long as every piece but the last is a multiple
+* of 32 bytes long.
+*/
+class SnapshotChecksum
+{
+public:
+    SnapshotChecksum();
+
+    void update(const void* data, std::size_t size);
+    uint64_t finish() const;
+
+private:
+    static uint64_t rotate(uint64_t value, int bits);
+    static uint64_t round(uint64_t lane, uint64_t word);
+    static uint64_t word(const unsigned char* bytes);
+
+    static const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+    static const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+    static const uint64_t prime3 = 0x165667B19E3779F9ull;
+
+    uint64_t lanes_[4];
+    uint64_t tail_;
+    uint64_t length_;
+};
+
+inline SnapshotChecksum::SnapshotChecksum() :
+    tail_(0),
+    length_(0)
+{
+    lanes_[0] = prime1 + prime2;
+    lanes_[1] = prime2;
+    lanes_[2] = 0;
+    lanes_[3] = 0 - prime1;
+}
+
+inline void SnapshotChecksum::update(const void* data, std::size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        lanes_[0] = round(lanes_[0], word(bytes + i));
+        lanes_[1] = round(lanes_[1], word(bytes + i + 8));
+        lanes_[2] = round(lanes_[2], word(bytes + i + 16));
+        lanes_[3] = round(lanes_[3], word(bytes + i + 24));
+    }
+    for (; i + 8 <= size; i += 8) {
+        tail_ = round(tail_, word(bytes + i));
+    }
+    if (i < size) {
+        unsigned char last[8] = { 0 };
+        std::memcpy(last, bytes + i, size - i);
+        tail_ = round(tail_, word(last));
+    }
+    length_ += size;
+}
+
+inline uint64_t SnapshotChecksum::finish() const
+{
+    uint64_t hash = rotate(lanes_[0], 1) + rotate(lanes_[1], 7) +
+                    rotate(lanes_[2], 12) + rotate(lanes_[3], 18);
+    hash = (hash ^ round(0, tail_)) * prime1 + length_;
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+inline uint64_t SnapshotChecksum::rotate(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t SnapshotChecksum::round(uint64_t lane, uint64_t word)
+{
+    return rotate(lane + word * prime2, 31) * prime1;
+}
+
+inline uint64_t SnapshotChecksum::word(const unsigned char* bytes)
+{
+    uint64_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+/**
+* The checksum stored in a snapshot's header: that of the header with
+* its checksum field zeroed, followed by the checksum of the rest of the
+* file, so that damage to either shows.
+*/
+inline uint64_t snapshotChecksum(const SnapshotHeader& header, uint64_t bodyChecksum)
+{
+    SnapshotHeader copy = header;
+    copy.checksum = 0;
+    SnapshotChecksum checksum;
+    checksum.update(&copy, sizeof(copy));
+    checksum.update(&bodyChecksum, sizeof(bodyChecksum));
+    return checksum.finish();
+}
+
+/**
+* Buffers a snapshot on its way to disk and checksums it a full buffer
+* at a time.
+*/
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(const std::string& path);
+    ~SnapshotWriter();
+
+    void write(const void* data, std::size_t size);
+    void pad(uint64_t offset);
+    uint64_t offset() const;
+    uint64_t close(const SnapshotHeader& header);
+
+private:
+    SnapshotWriter(const SnapshotWriter&);
+    SnapshotWriter& operator=(const SnapshotWriter&);
+
+    void flush();
+
+    // a multiple of 32, as SnapshotChecksum wants
+    static const std::size_t bufferSize = 1 << 20;
+
+    std::string path_;
+    std::FILE* file_;
+    std::vector<unsigned char> buffer_;
+    std::size_t used_;
+    uint64_t offset_;
+    SnapshotChecksum checksum_;
+};
+
+/**
+* Leaves room for the header, which close() fills in at the end.
+*/
+inline SnapshotWriter::SnapshotWriter(const std::string& path) :
+    path_(path),
+    file_(std::fopen(path.c_str(), "wb")),
+    buffer_(bufferSize),
+    used_(0),
+    offset_(sizeof(SnapshotHeader))
+{
+    if (file_ == nullptr) {
+        throw std::runtime_error("snapshot: cannot create " + path);
+    }
+    if (std::fseek(file_, sizeof(SnapshotHeader), SEEK_SET) != 0) {
+        std::fclose(file_);
+        std::remove(path.c_str());
+        throw std::runtime_error("snapshot: cannot write " + path);
+    }
+}
+
+/**
+* A writer destroyed before close() succeeded leaves no file behind.
+*/
+inline SnapshotWriter::~SnapshotWriter()
+{
+    if (file_ != nullptr) {
+        std::fclose(file_);
+        std::remove(path_.c_str());
+    }
+}
+
+inline void SnapshotWriter::write(const void* data, std::size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    while (size > 0) {
+        std::size_t chunk = std::min(size, bufferSize - used_);
+        std::memcpy(&buffer_[used_], bytes, chunk);
+        used_ += chunk;
+        bytes += chunk;
+        size -= chunk;
+        offset_ += chunk;
+        if (used_ == bufferSize) {
+            flush();
+        }
+    }
+}
+
+/**
+* Writes zeros up to offset.
+*/
+inline void SnapshotWriter::pad(uint64_t offset)
+{
+    static const unsigned char zeros[64] = { 0 };
+    while (offset_ < offset) {
+        write(zeros, std::min<uint64_t>(sizeof(zeros), offset - offset_));
+    }
+}
+
+inline uint64_t SnapshotWriter::offset() const
+{
+    return offset_;
+}
+
+/**
+* Writes out the rest of the data, then the header with the checksum filled
+* in. Returns the checksum.
+*/
+inline uint64_t SnapshotWriter::close(const SnapshotHeader& header)
+{
+    flush();
+    SnapshotHeader complete = header;
+    complete.checksum = snapshotChecksum(header, checksum_.finish());
+    bool ok = std::fseek(file_, 0, SEEK_SET) == 0 &&
+              std::fwrite(&complete, sizeof(complete), 1, file_) == 1;
+    ok = std::fclose(file_) == 0 && ok;
+    file_ = nullptr;
+    if (!ok) {
+        std::remove(path_.c_str());
+        throw std::runtime_error("snapshot: cannot write " + path_);
+    }
+    return complete.checksum;
+}
+
+inline void SnapshotWriter::flush()
+{
+    if (used_ == 0) {
+        return;
+    }
+    checksum_.update(&buffer_[0], used_);
+    if (std::fwrite(&buffer_[0], 1, used_, file_) != used_) {
+        throw std::runtime_error("snapshot: cannot write " + path_);
+    }
+    used_ = 0;
+}
+
+/**
+* Writes the items of [first, last), which must be sorted by key, to path
+* as a snapshot, walking the range once for the keys and once more for
+* the values. The file is built under a temporary name and renamed into
+* place, so a crash never leaves a half-written snapshot where a good one
+* was.
+*/
+template<typename Key, typename Value, typename ForwardIt>
+void writeSnapshot(const std::string& path, ForwardIt first, ForwardIt last)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "snapshots need trivially copyable keys and values");
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+
+    std::string temporary = path + ".tmp";
+    {
+        SnapshotWriter writer(temporary);
+        writer.pad((writer.offset() + 63) / 64 * 64);
+        header.keysOffset = writer.offset();
+        for (ForwardIt it = first; it != last; ++it) {
+            Key key = it->first;
+            writer.write(&key, sizeof(key));
+            header.count++;
+        }
+        writer.pad((writer.offset() + 63) / 64 * 64);
+        header.valuesOffset = writer.offset();
+        for (ForwardIt it = first; it != last; ++it) {
+            Value value = it->second;
+            writer.write(&value, sizeof(value));
+        }
+        header.fileSize = writer.offset();
+        writer.close(header);
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("snapshot: cannot rename " + temporary + " to " + path);
+    }
+}
+
+/**
+* A snapshot file mapped read-only into memory. Lookups binary search
+* the mapped key array, so nothing is copied or built and pages are read
+* in as they are touched. The file is checked in full on opening.
+*
+* begin() and end() walk the items in key order, handing out
+* std::pair<Key, Value> copies; that is how load() bulk builds a tree
+* from the mapping.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class MappedSnapshot
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "snapshots need trivially copyable keys and values");
+
+public:
+    explicit MappedSnapshot(const std::string& path, const Compare& comp = Compare());
+    ~MappedSnapshot();
+
+    bool empty() const;
+    std::size_t size() const;
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+
+    /**
+    * A forward iterator over the items in key order. The pair it points
+    * at is a copy held by the iterator.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<Key, Value>* pointer;
+        typedef const std::pair<Key, Value>& reference;
+
+        const_iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+
+    protected:
+        friend class MappedSnapshot<Key, Value, Compare>;
+        const_iterator(const MappedSnapshot<Key, Value, Compare>* snapshot, std::size_t index);
+
+        const MappedSnapshot<Key, Value, Compare>* snapshot_;
+        std::size_t index_;
+        mutable std::pair<Key, Value> item_;
+    };
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    MappedSnapshot(const MappedSnapshot&);
+    MappedSnapshot& operator=(const MappedSnapshot&);
+
+    void fail(const std::string& path, const char* problem);
+    std::size_t lowerBound(const Key& key) const;
+
+    void* map_;
+    std::size_t mapSize_;
+    const Key* keys_;
+    const Value* values_;
+    std::size_t count_;
+    Compare comp_;
+};
+
+/*
+-------------------------------------------------------------------
+Begin implementations for the MappedSnapshot::const_iterator class.
+-------------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+MappedSnapshot<Key, Value, Compare>::const_iterator::const_iterator() :
+    snapshot_(nullptr),
+    index_(0),
+    item_()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+MappedSnapshot<Key, Value, Compare>::const_iterator::const_iterator(
+    const MappedSnapshot<Key, Value, Compare>* snapshot, std::size_t index) :
+    snapshot_(snapshot),
+    index_(index),
+    item_()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+typename MappedSnapshot<Key, Value, Compare>::const_iterator::reference
+MappedSnapshot<Key, Value, Compare>::const_iterator::operator*() const
+{
+    item_.first = snapshot_->keys_[index_];
+    item_.second = snapshot_->values_[index_];
+    return item_;
+}
+
+template<class Key, class Value, class Compare>
+typename MappedSnapshot<Key, Value, Compare>::const_iterator::pointer
+MappedSnapshot<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &**this;
+}
+
+template<class Key, class Value, class Compare>
+bool MappedSnapshot<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return index_ == rhs.index_;
+}
+
+template<class Key, class Value, class Compare>
+bool MappedSnapshot<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value, class Compare>
+typename MappedSnapshot<Key, Value, Compare>::const_iterator&
+MappedSnapshot<Key, Value, Compare>::const_iterator::operator++()
+{
+    index_++;
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename MappedSnapshot<Key, Value, Compare>::const_iterator
+MappedSnapshot<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    index_++;
+    return old;
+}
+
+/*
+-----------------------------------------------------------------
+End implementations for the MappedSnapshot::const_iterator class.
+-----------------------------------------------------------------
+*/
+
+/*
+---------------------------------------------------
+Begin implementations for the MappedSnapshot class.
+---------------------------------------------------
+*/
+
+/**
+* Maps path and checks the header against Key and Value, then the
+* checksum. Throws std::runtime_error if anything is off.
+*/
+template<class Key, class Value, class Compare>
+MappedSnapshot<Key, Value, Compare>::MappedSnapshot(const std::string& path, const Compare& comp) :
+    map_(nullptr),
+    mapSize_(0),
+    keys_(nullptr),
+    values_(nullptr),
+    count_(0),
+    comp_(comp)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("snapshot: cannot open " + path);
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        throw std::runtime_error("snapshot: " + path + " is too short");
+    }
+    mapSize_ = static_cast<std::size_t>(info.st_size);
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    // read the whole file in one go rather than a page fault at a time
+    flags |= MAP_POPULATE;
+#endif
+    void* map = ::mmap(nullptr, mapSize_, PROT_READ, flags, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("snapshot: cannot map " + path);
+    }
+    map_ = map;
+
+    SnapshotHeader header;
+    std::memcpy(&header, map_, sizeof(header));
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        fail(path, "is not a snapshot");
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        fail(path, "has an unsupported version");
+    }
+    if (header.byteOrder != SNAPSHOT_BYTE_ORDER) {
+        fail(path, "was written with the other byte order");
+    }
+    if (header.keySize != sizeof(Key) || header.valueSize != sizeof(Value)) {
+        fail(path, "holds keys or values of another size");
+    }
+    // bound count by what fits before multiplying, so that a damaged
+    // count cannot wrap the sizes around
+    if (header.fileSize != mapSize_ ||
+        header.keysOffset % 64 != 0 || header.valuesOffset % 64 != 0 ||
+        header.keysOffset < sizeof(header) || header.keysOffset > header.valuesOffset ||
+        header.valuesOffset > mapSize_ ||
+        header.count > (mapSize_ - header.keysOffset) / sizeof(Key) ||
+        header.count > (mapSize_ - header.valuesOffset) / sizeof(Value) ||
+        header.keysOffset + header.count * sizeof(Key) > header.valuesOffset ||
+        header.valuesOffset + header.count * sizeof(Value) != mapSize_) {
+        fail(path, "is truncated or damaged");
+    }
+    const unsigned char* bytes = static_cast<const unsigned char*>(map_);
+    SnapshotChecksum checksum;
+    checksum.update(bytes + sizeof(header), mapSize_ - sizeof(header));
+    if (snapshotChecksum(header, checksum.finish()) != header.checksum) {
+        fail(path, "fails its checksum");
+    }
+    keys_ = reinterpret_cast<const Key*>(bytes + header.keysOffset);
+    values_ = reinterpret_cast<const Value*>(bytes + header.valuesOffset);
+    count_ = static_cast<std::size_t>(header.count);
+}
+
+template<class Key, class Value, class Compare>
+MappedSnapshot<Key, Value, Compare>::~MappedSnapshot()
+{
+    ::munmap(map_, mapSize_);
+}
+
+template<class Key, class Value, class Compare>
+bool MappedSnapshot<Key, Value, Compare>::empty() const
+{
+    return count_ == 0;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t MappedSnapshot<Key, Value, Compare>::size() const
+{
+    return count_;
+}
+
+/**
+* Copies the value stored under key into value and returns true, or
+* returns false if key is not there.
+*/
+template<class Key, class Value, class Compare>
+bool MappedSnapshot<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    std::size_t index = lowerBound(key);
+    if (index == count_ || comp_(key, keys_[index])) {
+        return false;
+    }
+    value = values_[index];
+    return true;
+}
+
+template<class Key, class Value, class Compare>
+bool MappedSnapshot<Key, Value, Compare>::contains(const Key& key) const
+{
+    std::size_t index = lowerBound(key);
+    return index != count_ && !comp_(key, keys_[index]);
+}
+
+template<class Key, class Value, class Compare>
+typename MappedSnapshot<Key, Value, Compare>::const_iterator
+MappedSnapshot<Key, Value, Compare>::begin() const
+{
+    return const_iterator(this, 0);
+}
+
+template<class Key, class Value, class Compare>
+typename MappedSnapshot<Key, Value, Compare>::const_iterator
+MappedSnapshot<Key, Value, Compare>::end() const
+{
+    return const_iterator(this, count_);
+}
+
+/**
+* Unmaps the file and throws; for the checks in the constructor, which
+* would otherwise leak the mapping.
+*/
+template<class Key, class Value, class Compare>
+void MappedSnapshot<Key, Value, Compare>::fail(const std::string& path, const char* problem)
+{
+    ::munmap(map_, mapSize_);
+    map_ = nullptr;
+    throw std::runtime_error("snapshot: " + path + " " + problem);
+}
+
+template<class Key, class Value, class Compare>
+std::size_t MappedSnapshot<Key, Value, Compare>::lowerBound(const Key& key) const
+{
+    return std::lower_bound(keys_, keys_ + count_, key, comp_) - keys_;
+}
+
+/*
+-------------------------------------------------
+End implementations for the MappedSnapshot class.
+-------------------------------------------------
+*/
+
+/**
+* Writes a tree's contents to path as a snapshot. Works with any tree
+* whose iterators walk it in key order. Throws std::runtime_error if the
+* file cannot be written, leaving whatever was at path before in place.
+*/
+template<typename Key, typename Value, typename Compare,
+         template<typename, typename, typename> class Tree>
+void save(const Tree<Key, Value, Compare>& tree, const std::string& path)
+{
+    writeSnapshot<Key, Value>(path, tree.begin(), tree.end());
+}
+
+/**
+* Replaces a tree's contents with a snapshot written by save(), mapping
+* the file and bulk building from it in O(n), for trees with assign()
+* such as BinarySearchTree and AVLTree. Throws std::runtime_error if the
+* file is missing, damaged or was written for other key or value types,
+* in which case the tree is left as it was.
+*/
+template<typename Key, typename Value, typename Compare,
+         template<typename, typename, typename> class Tree>
+void load(Tree<Key, Value, Compare>& tree, const std::string& path)
+{
+    MappedSnapshot<Key, Value, Compare> snapshot(path, tree.key_comp());
+    tree.assign(snapshot.begin(), snapshot.end());
+}
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A small work-stealing pool for fork-join parallelism.
+ *
+ * parallel(first, second) offers second to the pool, runs first on the
+ * calling thread and then waits for second. Each worker pushes and pops
+ * at the back of its own queue and steals from the front of the others',
+ * so it works depth first on its own tasks while idle workers take the
+ * biggest ones still waiting. A thread waiting for a stolen task runs
+ * other tasks meanwhile instead of blocking, so nested calls cannot
+ * deadlock.
+ *
+ * A pool of n threads starts n - 1 workers; the thread calling parallel()
+ * makes up the last one. With n == 1 everything runs on the caller.
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    unsigned size() const;
+
+    template<typename First, typename Second>
+    void parallel(First&& first, Second&& second);
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    struct Task
+    {
+        std::function<void()> run;
+        std::exception_ptr error;
+        std::atomic<bool> done;
+    };
+
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<Task*> tasks;
+    };
+
+    unsigned queueIndex() const;
+    void push(Task* task);
+    Task* take(unsigned index);
+    void execute(Task* task);
+    void workerLoop(unsigned index);
+
+    // one queue per worker, then one shared by threads outside the pool
+    std::vector<std::unique_ptr<Queue> > queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<unsigned> queued_;
+    std::mutex sleepLock_;
+    std::condition_variable wake_;
+    bool stopping_;
+};
+
+/**
+* Per-thread note of which pool, if any, the thread works for.
+*/
+struct ThreadPoolWorker
+{
+    const ThreadPool* pool;
+    unsigned index;
+};
+
+inline ThreadPoolWorker& currentThreadPoolWorker()
+{
+    static thread_local ThreadPoolWorker worker = { nullptr, 0 };
+    return worker;
+}
+
+/**
+* Starts threads - 1 workers; 0 (an unknown core count) counts as 1.
+*/
+inline ThreadPool::ThreadPool(unsigned threads) :
+    queued_(0),
+    stopping_(false)
+{
+    threads = std::max(threads, 1u);
+    for (unsigned i = 0; i < threads; ++i) {
+        queues_.push_back(std::unique_ptr<Queue>(new Queue));
+    }
+    for (unsigned i = 0; i + 1 < threads; ++i) {
+        workers_.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+/**
+* Stops the workers. No parallel() call may still be running.
+*/
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(sleepLock_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i].join();
+    }
+}
+
+/**
+* Number of threads that run tasks, counting the caller.
+*/
+inline unsigned ThreadPool::size() const
+{
+    return static_cast<unsigned>(workers_.size()) + 1;
+}
+
+/**
+* Runs first and second, possibly at the same time, and returns once both
+* are done. If either throws, the exception is rethrown here after both
+* have finished.
+*/
+template<typename First, typename Second>
+void ThreadPool::parallel(First&& first, Second&& second)
+{
+    Task task;
+    task.run = std::forward<Second>(second);
+    task.done.store(false, std::memory_order_relaxed);
+    push(&task);
+
+    std::exception_ptr error;
+    try {
+        first();
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+
+    // help out until second is done; this may well run second itself
+    unsigned index = queueIndex();
+    while (!task.done.load(std::memory_order_acquire)) {
+        Task* other = take(index);
+        if (other != nullptr) {
+            execute(other);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (task.error) {
+        std::rethrow_exception(task.error);
+    }
+}
+
+/**
+* The calling thread's own queue: its worker queue, or the shared last
+* one for threads outside this pool.
+*/
+inline unsigned ThreadPool::queueIndex() const
+{
+    const ThreadPoolWorker& worker = currentThreadPoolWorker();
+    if (worker.pool == this) {
+        return worker.index;
+    }
+    return static_cast<unsigned>(queues_.size()) - 1;
+}
+
+inline void ThreadPool::push(Task* task)
+{
+    Queue& queue = *queues_[queueIndex()];
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(task);
+    }
+    {
+        // taken so that a worker about to sleep cannot miss the wakeup
+        std::lock_guard<std::mutex> guard(sleepLock_);
+        queued_.fetch_add(1, std::memory_order_relaxed);
+    }
+    wake_.notify_one();
+}
+
+/**
+* Pops the newest task from queue index, or else steals the oldest task
+* from one of the other queues. Returns NULL if there is none anywhere.
+*/
+inline ThreadPool::Task* ThreadPool::take(unsigned index)
+{
+    if (queued_.load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
+    for (std::size_t i = 0; i < queues_.size(); ++i) {
+        Queue& queue = *queues_[(index + i) % queues_.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        Task* task;
+        if (i == 0) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        } else {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+    }
+    return nullptr;
+}
+
+inline void ThreadPool::execute(Task* task)
+{
+    try {
+        task->run();
+    }
+    catch (...) {
+        task->error = std::current_exception();
+    }
+    task->done.store(true, std::memory_order_release);
+}
+
+inline void ThreadPool::workerLoop(unsigned index)
+{
+    ThreadPoolWorker& worker = currentThreadPoolWorker();
+    worker.pool = this;
+    worker.index = index;
+    while (true) {
+        Task* task = take(index);
+        if (task != nullptr) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleepLock_);
+        wake_.wait(guard, [this]() {
+            return stopping_ || queued_.load(std::memory_order_relaxed) > 0;
+        });
+        if (stopping_) {
+            return;
+        }
+    }
+}
+
+#endif